@@ -0,0 +1,146 @@
+/**
+ * addr_space.c - Synthetic address spaces for benchmarking procReport scans
+ *
+ * Builds one controlled address space, prints its PID and sleeps until it is
+ * killed, so the bench scripts can point the module at it (target_pids, or
+ * vma_bench_pid for the vmas shape).
+ * Every shape stresses a different part of the walker:
+ *
+ *   dense  <MiB>  Anonymous memory, every page touched: the PTE loop.
+ *   sparse <MiB>  A huge reservation with one page touched per GiB: hole
+ *                 skipping in the upper levels.
+ *   thp    <MiB>  2 MiB aligned memory with MADV_HUGEPAGE: PMD leaf entries.
+ *   frag   <MiB>  Dense memory after munmap()/mmap() churn on every other
+ *                 page: short physical runs.
+ *   vmas   <N>    N single-page VMAs: VMA iteration, also the target of
+ *                 run_vma_bench.sh.
+ *
+ * Usage: ./addr_space <shape> <size>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define MIB (1UL << 20)
+#define GIB (1UL << 30)
+#define PMD_BYTES (2 * MIB)
+
+static long page_size;
+
+static char *map_anon(unsigned long len, int prot)
+{
+    char *p = mmap(NULL, len, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return p;
+}
+
+// Write one byte per page so each page is faulted in.
+static void touch(char *p, unsigned long len, unsigned long stride)
+{
+    unsigned long off;
+
+    for (off = 0; off < len; off += stride)
+        p[off] = 0x5a;
+}
+
+static void build_dense(unsigned long mib)
+{
+    touch(map_anon(mib * MIB, PROT_READ | PROT_WRITE), mib * MIB, page_size);
+}
+
+static void build_sparse(unsigned long mib)
+{
+    // One resident page per GiB of reservation.
+    touch(map_anon(mib * MIB, PROT_READ | PROT_WRITE), mib * MIB, GIB);
+}
+
+static void build_thp(unsigned long mib)
+{
+    unsigned long len = mib * MIB;
+    char *p = map_anon(len + PMD_BYTES, PROT_READ | PROT_WRITE);
+
+    // Align the start to 2 MiB so every huge page lands on a PMD entry.
+    p = (char *)(((unsigned long)p + PMD_BYTES - 1) & ~(PMD_BYTES - 1));
+    if (madvise(p, len, MADV_HUGEPAGE))
+        perror("madvise(MADV_HUGEPAGE)");
+    touch(p, len, page_size);
+}
+
+static void build_frag(unsigned long mib)
+{
+    unsigned long len = mib * MIB;
+    char *p = map_anon(len, PROT_READ | PROT_WRITE);
+    unsigned long off;
+
+    touch(p, len, page_size);
+
+    // Free every other page, let a second allocation take those frames, then
+    // fault the holes back in so they land somewhere else physically.
+    for (off = 0; off < len; off += 2 * page_size) {
+        if (munmap(p + off, page_size) ||
+            mmap(p + off, page_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+            perror("munmap/mmap churn");
+            exit(1);
+        }
+    }
+    touch(map_anon(len / 2, PROT_READ | PROT_WRITE), len / 2, page_size);
+    for (off = 0; off < len; off += 2 * page_size)
+        p[off] = 0x5a;
+}
+
+static void build_vmas(unsigned long nr_vmas)
+{
+    char *p = map_anon(nr_vmas * page_size, PROT_NONE);
+    unsigned long i;
+
+    // A read/write page between PROT_NONE pages cannot merge with either side.
+    for (i = 0; i < nr_vmas; i += 2) {
+        if (mprotect(p + i * page_size, page_size, PROT_READ | PROT_WRITE)) {
+            perror("mprotect (check /proc/sys/vm/max_map_count)");
+            exit(1);
+        }
+        p[i * page_size] = 0x5a;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long size = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+    const char *shape = argc > 1 ? argv[1] : "";
+
+    page_size = sysconf(_SC_PAGESIZE);
+    if (!size) {
+        fprintf(stderr, "usage: %s dense|sparse|thp|frag <MiB> | vmas <N>\n", argv[0]);
+        return 1;
+    }
+
+    if (!strcmp(shape, "dense"))
+        build_dense(size);
+    else if (!strcmp(shape, "sparse"))
+        build_sparse(size);
+    else if (!strcmp(shape, "thp"))
+        build_thp(size);
+    else if (!strcmp(shape, "frag"))
+        build_frag(size);
+    else if (!strcmp(shape, "vmas"))
+        build_vmas(size);
+    else {
+        fprintf(stderr, "%s: unknown shape '%s'\n", argv[0], shape);
+        return 1;
+    }
+
+    printf("%d\n", getpid());
+    fflush(stdout);
+
+    for (;;)
+        pause();
+}
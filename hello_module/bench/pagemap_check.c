@@ -0,0 +1,279 @@
+/**
+ * pagemap_check - Check procReport counts against /proc/PID/pagemap
+ *
+ * Reads one report from the module, then recomputes total, contig and
+ * noncontig pages of every reported process from userspace: the VMAs come
+ * from /proc/PID/maps, the page frames from /proc/PID/pagemap, and the pages
+ * are classified the way the original virt2phys loop did it. A page is
+ * contiguous when its frame directly follows the frame of the previous
+ * present page, across VMA boundaries, and the first present page counts as
+ * non-contiguous.
+ *
+ * Every process whose counts differ is printed to stderr as
+ *
+ *   MISMATCH pid,name,field,module,pagemap
+ *
+ * followed by one summary line on stdout:
+ *
+ *   label,processes,mismatches,pages,module_us,pagemap_us
+ *
+ * module_us is the time taken to read the report, pagemap_us the time taken
+ * to recompute it, so the line also works as a regression benchmark. Counts
+ * only match for processes that do not fault or unmap between the two reads,
+ * such as bench/addr_space targets; run_pagemap_check.sh sets that up.
+ *
+ * Needs root: pagemap hides page frame numbers from everybody else.
+ *
+ * Usage: ./pagemap_check [label] [report]   (default: check /proc/procReport)
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PM_PRESENT     (1ULL << 63)
+#define PM_PFN_MASK    ((1ULL << 55) - 1)
+#define PM_BATCH       4096            // pagemap entries read per pread()
+#define MAX_ROWS       65536
+#define TASK_SIZE_MAX  0x800000000000UL // Above this are [vsyscall] and the kernel
+
+struct counts {
+    unsigned long total;
+    unsigned long contig;
+    unsigned long noncontig;
+};
+
+struct row {
+    int pid;
+    char name[64];
+    struct counts module;
+};
+
+static long page_size;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Index of column @name in the CSV header @hdr, or -1.
+static int column_of(const char *hdr, const char *name)
+{
+    size_t len = strlen(name);
+    int col = 0;
+
+    for (;;) {
+        if (!strncmp(hdr, name, len) && (hdr[len] == ',' || hdr[len] == '\n' || !hdr[len]))
+            return col;
+        hdr = strchr(hdr, ',');
+        if (!hdr)
+            return -1;
+        hdr++;
+        col++;
+    }
+}
+
+/**
+ * read_report - Parse the process rows of a procReport CSV.
+ * @path:  Report file.
+ * @rows:  Filled with the rows, TOTALS left out.
+ *
+ * proc_name is the only field that can contain a comma. A row with more
+ * fields than the header is taken to have that many commas in its name,
+ * and the columns after the name are shifted to match.
+ *
+ * Returns the number of rows, or -1 on error.
+ */
+static int read_report(const char *path, struct row *rows)
+{
+    int c_pid, c_name, c_total, c_contig, c_noncontig, nr_cols = 1;
+    char line[4096];
+    FILE *f = fopen(path, "r");
+    char *field;
+    int nr = 0;
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    if (!fgets(line, sizeof(line), f)) {
+        fprintf(stderr, "%s: empty report\n", path);
+        fclose(f);
+        return -1;
+    }
+    c_pid = column_of(line, "proc_id");
+    c_name = column_of(line, "proc_name");
+    c_total = column_of(line, "total_pages");
+    c_contig = column_of(line, "contig_pages");
+    c_noncontig = column_of(line, "noncontig_pages");
+    if (c_pid < 0 || c_name < 0 || c_total < 0 || c_contig < 0 || c_noncontig < 0) {
+        fprintf(stderr, "%s: not a procReport page count report\n", path);
+        fclose(f);
+        return -1;
+    }
+    for (field = line; (field = strchr(field, ',')); field++)
+        nr_cols++;
+
+    while (nr < MAX_ROWS && fgets(line, sizeof(line), f)) {
+        struct row *r = &rows[nr];
+        char *cur = line, *name = NULL;
+        int col = 0, extra = 1;
+
+        if (line[0] == '#' || !strncmp(line, "TOTALS,", 7))
+            continue;
+        memset(r, 0, sizeof(*r));
+        line[strcspn(line, "\n")] = '\0';
+        for (field = line; (field = strchr(field, ',')); field++)
+            extra++;
+        extra -= nr_cols;
+
+        // strsep() keeps empty fields, unlike strtok().
+        while ((field = strsep(&cur, ","))) {
+            if (col == c_name && extra > 0) {
+                if (!name)
+                    name = field;
+                field[strlen(field)] = ',';         // Rejoin the name
+                extra--;
+                continue;
+            }
+            if (col == c_pid)
+                r->pid = atoi(field);
+            else if (col == c_name)
+                snprintf(r->name, sizeof(r->name), "%s", name ? name : field);
+            else if (col == c_total)
+                r->module.total = strtoul(field, NULL, 10);
+            else if (col == c_contig)
+                r->module.contig = strtoul(field, NULL, 10);
+            else if (col == c_noncontig)
+                r->module.noncontig = strtoul(field, NULL, 10);
+            col++;
+        }
+        nr++;
+    }
+    fclose(f);
+    return nr;
+}
+
+/**
+ * pagemap_counts - Count the pages of @pid the way the module does.
+ * @pid: Process to count.
+ * @c:   Filled with the counts.
+ *
+ * Returns 0, or -1 if the process is gone or pagemap cannot be read.
+ */
+static int pagemap_counts(int pid, struct counts *c)
+{
+    static uint64_t entries[PM_BATCH];
+    unsigned long start, end;
+    uint64_t prev_pfn = 0;
+    char path[64], line[512];
+    FILE *maps;
+    int pm;
+
+    memset(c, 0, sizeof(*c));
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    maps = fopen(path, "r");
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", pid);
+    pm = open(path, O_RDONLY);
+    if (!maps || pm < 0) {
+        if (maps)
+            fclose(maps);
+        if (pm >= 0)
+            close(pm);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), maps)) {
+        unsigned long addr;
+
+        if (sscanf(line, "%lx-%lx", &start, &end) != 2 || start >= TASK_SIZE_MAX)
+            continue;
+        for (addr = start; addr < end; ) {
+            size_t n = (end - addr) / page_size;
+            ssize_t got;
+            size_t i;
+
+            if (n > PM_BATCH)
+                n = PM_BATCH;
+            got = pread(pm, entries, n * sizeof(*entries), addr / page_size * sizeof(*entries));
+            if (got <= 0)
+                break;
+            n = got / sizeof(*entries);
+            for (i = 0; i < n; i++) {
+                uint64_t pfn = entries[i] & PM_PFN_MASK;
+
+                if (!(entries[i] & PM_PRESENT))
+                    continue;
+                if (!pfn) {
+                    fprintf(stderr, "pagemap_check: no PFNs in pagemap, run as root\n");
+                    exit(2);
+                }
+                c->total++;
+                if (prev_pfn && pfn == prev_pfn + 1)
+                    c->contig++;
+                else
+                    c->noncontig++;
+                prev_pfn = pfn;
+            }
+            addr += n * page_size;
+        }
+    }
+    fclose(maps);
+    close(pm);
+    return 0;
+}
+
+static int compare(const struct row *r, const char *field, unsigned long module,
+                   unsigned long pagemap)
+{
+    if (module == pagemap)
+        return 0;
+    fprintf(stderr, "MISMATCH %d,%s,%s,%lu,%lu\n", r->pid, r->name, field, module, pagemap);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *label = argc > 1 ? argv[1] : "default";
+    const char *report = argc > 2 ? argv[2] : "/proc/procReport";
+    static struct row rows[MAX_ROWS];
+    unsigned long pages = 0;
+    int nr, i, checked = 0, mismatches = 0;
+    uint64_t t0, t1, t2;
+
+    page_size = sysconf(_SC_PAGESIZE);
+
+    t0 = now_us();
+    nr = read_report(report, rows);
+    t1 = now_us();
+    if (nr < 0)
+        return 2;
+
+    for (i = 0; i < nr; i++) {
+        struct counts c;
+        int bad = 0;
+
+        if (pagemap_counts(rows[i].pid, &c))
+            continue;           // Exited since the report, or a kernel thread
+        checked++;
+        pages += c.total;
+        bad |= compare(&rows[i], "total_pages", rows[i].module.total, c.total);
+        bad |= compare(&rows[i], "contig_pages", rows[i].module.contig, c.contig);
+        bad |= compare(&rows[i], "noncontig_pages", rows[i].module.noncontig, c.noncontig);
+        mismatches += bad;
+    }
+    t2 = now_us();
+
+    printf("%s,%d,%d,%lu,%llu,%llu\n", label, checked, mismatches, pages,
+           (unsigned long long)(t1 - t0), (unsigned long long)(t2 - t1));
+    return mismatches ? 1 : 0;
+}
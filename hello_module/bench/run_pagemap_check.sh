@@ -0,0 +1,68 @@
+#!/bin/sh
+# run_pagemap_check.sh - Check the module's counts against /proc/PID/pagemap.
+#
+# Run as root from any directory after "make" and "make bench", with the
+# module not loaded. One bench/addr_space target of each shape is started,
+# then the module is loaded once per walker configuration below and
+# bench/pagemap_check compares its report for the targets with counts
+# recomputed from pagemap. The output has one CSV line per configuration:
+#
+#   config,processes,mismatches,pages,module_us,pagemap_us
+#
+# Mismatching processes are listed on stderr, and the exit status is 1 if
+# any configuration disagrees with pagemap.
+#
+# Usage: sudo ./bench/run_pagemap_check.sh [shape:size ...]
+#        (default: dense:256 sparse:16384 thp:256 frag:128 vmas:5000)
+
+set -e
+cd "$(dirname "$0")/.."
+
+PARAMS=/sys/module/procReport/parameters
+SHAPES=${*:-"dense:256 sparse:16384 thp:256 frag:128 vmas:5000"}
+
+# name:insmod parameters. Each one drives a different walker path.
+CONFIGS="serial:scan_workers=1
+parallel:scan_workers=4
+split:scan_workers=4,split_vma_mb=4,split_chunk_mb=2
+short_holds:lock_hold_us=1
+stream:stream_report=1"
+
+if [ -d "$PARAMS" ]; then
+    echo "run_pagemap_check.sh: unload procReport first" >&2
+    exit 2
+fi
+
+pids=
+cleanup() {
+    for pid in $pids; do
+        kill "$pid" 2>/dev/null || true
+    done
+    if [ -d "$PARAMS" ]; then
+        rmmod procReport
+    fi
+}
+trap cleanup EXIT
+
+for spec in $SHAPES; do
+    out=/tmp/pagemap_check.$$.${spec%%:*}
+    rm -f "$out"
+    ./bench/addr_space "${spec%%:*}" "${spec#*:}" > "$out" &
+    pids="$pids $!"
+
+    # Wait for the target to finish building its address space.
+    while [ ! -s "$out" ]; do
+        sleep 0.1
+    done
+    rm -f "$out"
+done
+
+status=0
+echo "config,processes,mismatches,pages,module_us,pagemap_us"
+for config in $CONFIGS; do
+    insmod procReport.ko $(echo "${config#*:}" | tr ',' ' ')
+    echo "$pids" > "$PARAMS/target_pids"
+    ./bench/pagemap_check "${config%%:*}" || status=1
+    rmmod procReport
+done
+exit $status
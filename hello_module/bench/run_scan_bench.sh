@@ -0,0 +1,101 @@
+#!/bin/sh
+# run_scan_bench.sh - Time procReport scans of synthetic address spaces.
+#
+# Run as root from any directory after "make" and "make bench". For each
+# shape, bench/addr_space builds the address space, the module is pointed at
+# it through target_pids, and the scan is repeated ROUNDS times. The figures
+# come from /sys/kernel/debug/procReport/stats and are printed as one CSV line
+# per shape:
+#
+#   shape,size,rounds,best_scan_us,best_walk_us,ptes,ptes_per_sec,lock_holds,lock_hold_us
+#
+# Save the output of one build as a baseline and pass it as BASELINE to a
+# later run to print the change of best_scan_us next to each line.
+#
+# Usage: sudo [ROUNDS=n] [BASELINE=file] ./bench/run_scan_bench.sh [shape:size ...]
+#        (default: dense:1024 sparse:65536 thp:1024 frag:512 vmas:20000)
+
+set -e
+cd "$(dirname "$0")/.."
+
+ROUNDS=${ROUNDS:-10}
+PARAMS=/sys/module/procReport/parameters
+STATS=/sys/kernel/debug/procReport/stats
+SHAPES=${*:-"dense:1024 sparse:65536 thp:1024 frag:512 vmas:20000"}
+
+stat_of() {
+    awk -v key="$1:" '$1 == key { print $2 }' "$STATS"
+}
+
+loaded=
+if [ ! -d "$PARAMS" ]; then
+    insmod procReport.ko
+    loaded=1
+fi
+[ -r "$STATS" ] || mount -t debugfs none /sys/kernel/debug 2>/dev/null || true
+
+# Cached results would hide the walk being measured.
+incremental=$(cat "$PARAMS/incremental")
+echo N > "$PARAMS/incremental"
+
+bench_pid=
+cleanup() {
+    if [ -n "$bench_pid" ]; then
+        kill "$bench_pid" 2>/dev/null || true
+    fi
+    echo > "$PARAMS/target_pids"
+    echo "$incremental" > "$PARAMS/incremental"
+    if [ -n "$loaded" ]; then
+        rmmod procReport
+    fi
+}
+trap cleanup EXIT
+
+echo "shape,size,rounds,best_scan_us,best_walk_us,ptes,ptes_per_sec,lock_holds,lock_hold_us"
+for spec in $SHAPES; do
+    shape=${spec%%:*}
+    size=${spec#*:}
+
+    rm -f /tmp/addr_space.pid
+    ./bench/addr_space "$shape" "$size" > /tmp/addr_space.pid &
+    bench_pid=$!
+
+    # Wait for the target to finish building its address space.
+    while [ ! -s /tmp/addr_space.pid ]; do
+        sleep 0.1
+    done
+    echo "$bench_pid" > "$PARAMS/target_pids"
+
+    best_scan=
+    best_walk=
+    holds0=$(stat_of lock_holds)
+    hold_us0=$(stat_of lock_hold_us_total)
+    i=0
+    while [ "$i" -lt "$ROUNDS" ]; do
+        cat /proc/procReport > /dev/null
+        scan=$(stat_of last_scan_us)
+        walk=$(stat_of last_walk_us)
+        if [ -z "$best_scan" ] || [ "$scan" -lt "$best_scan" ]; then
+            best_scan=$scan
+            best_walk=$walk
+            ptes=$(stat_of last_ptes)
+            pps=$(stat_of last_ptes_per_sec)
+        fi
+        i=$((i + 1))
+    done
+    holds=$(( $(stat_of lock_holds) - holds0 ))
+    hold_us=$(( $(stat_of lock_hold_us_total) - hold_us0 ))
+
+    line="$shape,$size,$ROUNDS,$best_scan,$best_walk,$ptes,$pps,$holds,$hold_us"
+    if [ -n "$BASELINE" ]; then
+        base=$(awk -F, -v s="$shape" -v z="$size" '$1 == s && $2 == z { print $4 }' "$BASELINE")
+        if [ -n "$base" ] && [ "$base" -gt 0 ]; then
+            line="$line  # $(( (best_scan - base) * 100 / base ))% vs baseline"
+        fi
+    fi
+    echo "$line"
+
+    kill "$bench_pid"
+    wait "$bench_pid" 2>/dev/null || true
+    bench_pid=
+done
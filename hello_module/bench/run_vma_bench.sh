@@ -0,0 +1,24 @@
+#!/bin/sh
+# run_vma_bench.sh - Time VMA iteration in procReport against a 10k-VMA process.
+#
+# Run as root from hello_module/ after "make" and "make bench". Running the
+# same command on a 5.x and a 6.1+ kernel compares the linked VMA list with
+# the maple tree.
+#
+# Usage: sudo ./bench/run_vma_bench.sh [nr_vmas]
+
+set -e
+cd "$(dirname "$0")/.."
+
+./bench/addr_space vmas "${1:-10000}" > /tmp/vma_bench.pid &
+bench_pid=$!
+trap 'kill $bench_pid 2>/dev/null' EXIT
+
+# Wait for the target to finish building its address space.
+while [ ! -s /tmp/vma_bench.pid ]; do
+    sleep 0.1
+done
+
+insmod procReport.ko vma_bench_pid="$bench_pid"
+rmmod procReport
+dmesg | grep 'vma_bench:' | tail -n 1
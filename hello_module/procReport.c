@@ -1,15 +1,45 @@
 /**
  * helloModule.c - Linux Kernel Module for Reporting Allocated Pages
  *
- * This module iterates over all running processes with a PID greater than 650,
- * examines their virtual memory areas, and counts the number of physical pages
- * allocated. It further differentiates between pages that are mapped contiguously
+ * This module iterates over the selected running processes (by default every
+ * process with a PID greater than 650; see the min_pid and target_* module
+ * parameters), examines their virtual memory areas, and counts the number of
+ * physical pages allocated. It further differentiates between pages that are mapped contiguously
  * versus non-contiguously in physical memory.
  *
- * The results are printed in CSV format to the kernel log.
+ * The results are exposed in CSV format through /proc/procReport; every open
+ * of the file produces a fresh report without touching the kernel log.
+ * /proc/procReport_vmas (CSV) and /proc/procReport_vmas.bin break the same
+ * counts down per VMA and per VMA class (heap, stack, file text, shmem, ...).
+ * /proc/procReport_delta lists only the processes that appeared, exited or
+ * changed since it was last read, and /proc/procReport_estimate estimates the
+ * counts from a sample of the page tables. With track_events, target
+ * processes are watched through mmu notifiers, and /proc/procReport_live
+ * shows their last counts and whether they changed without walking them.
+ * /proc/procReport_runs gives the log2 histogram of physical run lengths and
+ * how many 2 MiB blocks could be mapped by a PMD, to judge THP compaction.
+ * With phys_map, the scan also marks the 2 MiB physical blocks it finds
+ * mapped: /proc/procReport_physmap counts unmapped, sparse, partial and full
+ * 2 MiB and 1 GiB blocks, and /proc/procReport_physmap_pins shows which
+ * processes pin pages in sparse blocks that compaction could otherwise free.
+ * With ring_records set, each scan is also written as fixed-size binary records to
+ * a ring buffer that collectors mmap() from /dev/procReport (see
+ * procReport_abi.h). /dev/procReport_ctl takes asynchronous scan requests
+ * for sets of PIDs by ioctl() and signals their results through poll().
+ * With sample_interval_ms set, a background worker rescans at that interval
+ * and readers are served the latest snapshot without waiting.
+ * With stream_report set instead, each process is walked only when the reader
+ * reaches its row, so memory use does not grow with the number of processes.
+ * Processes are scanned in parallel on a bounded pool of workers (see the scan_workers
+ * module parameter), each on the NUMA node holding the page tables it walks
+ * (numa_workers), and the report counts resident pages per node. With
+ * scan_cpu_permille set, scans are throttled to that share of one CPU on a
+ * single worker and back off further while the machine is loaded. Scan
+ * statistics are in /sys/kernel/debug/procReport/stats, and procreport:*
+ * tracepoints mark VMA, lock-hold, process and scan boundaries.
  *
- * NOTE: This module is best used on Linux kernel version 5.x. If you are running a
- * kernel 6.x system, unexpected behavior may occur due to changes in memory management.
+ * NOTE: VMAs are visited through a small compatibility layer, so the module
+ * builds against both the 5.x linked VMA list and the 6.1+ maple tree.
  */
 
 //----------------------------------
@@ -26,189 +56,5310 @@
 #include <asm/io.h>             // For PAGE_MASK and I/O operations
 #include <asm/pgtable.h>        // For page table related functions/macros
 #include <linux/highmem.h>      // For pte_offset_map() and pte_unmap()
+#include <linux/huge_mm.h>      // For pmd_trans_huge() and HPAGE_PMD_NR
+#include <linux/hugetlb.h>      // For is_vm_hugetlb_page()
+#include <linux/sched/mm.h>     // For get_task_mm() and mmput()
+#include <linux/sched/task.h>   // For get_task_struct() and put_task_struct()
+#include <linux/moduleparam.h>  // For module_param()
+#include <linux/workqueue.h>    // For the scan worker pool
+#include <linux/slab.h>         // For kcalloc() and kfree()
+#include <linux/ktime.h>        // For timing the scan
+#include <linux/version.h>      // For LINUX_VERSION_CODE
+#include <linux/pid.h>          // For looking up the VMA benchmark target
+#include <linux/proc_fs.h>      // For the /proc/procReport entry
+#include <linux/seq_file.h>     // For streaming the report to readers
+#include <linux/miscdevice.h>   // For /dev/procReport
+#include <linux/fs.h>           // For file_operations
+#include <linux/vmalloc.h>      // For the mmap()-able ring buffer
+#include <linux/mutex.h>        // For serializing ring producers
+#include <linux/log2.h>         // For roundup_pow_of_two()
+#include <linux/rcupdate.h>    // For swapping in new snapshots
+#include <linux/refcount.h>     // For snapshot lifetimes
+#include <linux/jiffies.h>      // For msecs_to_jiffies()
+#include <linux/hashtable.h>    // For the incremental result cache
+#include <linux/cgroup.h>       // For cgroup v2 scan targets
+#include <linux/shmem_fs.h>     // For shmem_file() in VMA classification
+#include <linux/swapops.h>      // For telling swap entries from migration entries
+#include <linux/debugfs.h>      // For the statistics file
+#include <linux/math64.h>       // For div_u64() on 32-bit builds
+#include <linux/sort.h>         // For matching up delta report rows
+#include <linux/hash.h>         // For hash_64() in sampled walks
+#include <linux/random.h>       // For get_random_u32() sampling seeds
+#include <linux/mmu_notifier.h> // For tracking invalidations of target mms
+#include <linux/delay.h>        // For usleep_range() in throttled scans
+#include <linux/sched/loadavg.h>// For avenrun[] in throttle backoff
+#include <linux/uaccess.h>      // For copying on-demand scan requests and results
+#include <linux/poll.h>         // For poll() on /dev/procReport_ctl
+#include <linux/mmzone.h>       // For NUMA node spans
+#include <linux/nodemask.h>     // For nr_node_ids
+#include "procReport_abi.h"     // Binary record layout shared with userspace
+
+#define CREATE_TRACE_POINTS
+#include "procReport_trace.h"   // procreport:* tracepoints
 
 MODULE_AUTHOR("Dalton Mlitimore");     // Author name
 MODULE_DESCRIPTION("Kernel module that reports allocated physical pages per process");
 MODULE_VERSION("0.1");          // Version of the module
+MODULE_LICENSE("GPL");          // Needed for get_task_mm() and the workqueue API
+
+//----------------------------------
+//        MODULE PARAMETERS
+//----------------------------------
+static unsigned int scan_workers;   // 0 = one worker per online CPU
+module_param(scan_workers, uint, 0444);
+MODULE_PARM_DESC(scan_workers,
+                 "Number of parallel scan workers (0 = one per online CPU, 1 = serial)");
+
+static unsigned int split_vma_mb = 1024;    // VMAs this large are split
+module_param(split_vma_mb, uint, 0444);
+MODULE_PARM_DESC(split_vma_mb,
+                 "Split VMAs of at least this many MiB between workers (0 = never split)");
+
+static unsigned int split_chunk_mb = 256;   // Size of one split piece
+module_param(split_chunk_mb, uint, 0444);
+MODULE_PARM_DESC(split_chunk_mb,
+                 "Size in MiB of the PMD-aligned chunks a split VMA is cut into");
+
+static unsigned int lock_hold_us = 500;     // 0 = hold for a whole unit
+module_param(lock_hold_us, uint, 0644);
+MODULE_PARM_DESC(lock_hold_us,
+                 "Longest mmap_read_lock() hold in microseconds before the scan yields (0 = no limit)");
+
+static unsigned int scan_cpu_permille;      // 0 = scan at full speed
+module_param(scan_cpu_permille, uint, 0644);
+MODULE_PARM_DESC(scan_cpu_permille,
+                 "CPU budget of all scan walks together in thousandths of one CPU, e.g. 20 = 2% (0 = unthrottled)");
+
+static bool scan_backoff = true;            // Throttle harder on a loaded machine
+module_param(scan_backoff, bool, 0644);
+MODULE_PARM_DESC(scan_backoff,
+                 "Stretch throttled scans further while the load average exceeds the online CPUs");
+
+static bool incremental;                    // Reuse results of unchanged mms
+module_param(incremental, bool, 0644);
+MODULE_PARM_DESC(incremental,
+                 "Skip walking processes whose page-table counters did not change since the last scan");
+
+static bool track_events;                   // mmu notifiers on target_pids
+module_param(track_events, bool, 0644);
+MODULE_PARM_DESC(track_events,
+                 "In incremental mode, watch the mms of target_pids for invalidations so moved pages are rescanned too");
+
+static unsigned int incremental_full_every = 10;
+module_param(incremental_full_every, uint, 0644);
+MODULE_PARM_DESC(incremental_full_every,
+                 "In incremental mode, walk everything on every Nth scan anyway (0 = never)");
+
+static bool numa_workers = true;            // Walk page tables from their node
+module_param(numa_workers, bool, 0644);
+MODULE_PARM_DESC(numa_workers,
+                 "On NUMA machines, run each walk on the node holding the process's page tables");
+
+static bool pss_accounting;                 // Look at struct page for PSS
+module_param(pss_accounting, bool, 0644);
+MODULE_PARM_DESC(pss_accounting,
+                 "Compute PSS and exact anon/file splits from page mapcounts (costs one struct page load per page)");
+
+static bool unique_mm_only;                 // Hide rows of CLONE_VM sharers
+module_param(unique_mm_only, bool, 0644);
+MODULE_PARM_DESC(unique_mm_only,
+                 "Report one row per distinct address space, hiding processes that share another's mm");
+
+static bool stream_report;                  // Walk processes as they are read
+module_param(stream_report, bool, 0644);
+MODULE_PARM_DESC(stream_report,
+                 "Walk each process while /proc/procReport is read instead of scanning all of them on open");
+
+static unsigned int delta_threshold;        // 0 = report any change
+module_param(delta_threshold, uint, 0644);
+MODULE_PARM_DESC(delta_threshold,
+                 "In /proc/procReport_delta, only report processes whose page counts moved by more than this");
+
+static unsigned int estimate_permille = 100;    // Share of PTE tables sampled
+module_param(estimate_permille, uint, 0644);
+MODULE_PARM_DESC(estimate_permille,
+                 "Share of PTE tables /proc/procReport_estimate walks, in 1/1000 (1000 = exact)");
+
+static bool estimate_exact;                 // Calibrate against an exact walk
+module_param(estimate_exact, bool, 0644);
+MODULE_PARM_DESC(estimate_exact,
+                 "Also walk every process exactly in /proc/procReport_estimate, for calibration");
+
+static bool phys_map;                       // Build the physical block map
+module_param(phys_map, bool, 0644);
+MODULE_PARM_DESC(phys_map,
+                 "Map the physical 2 MiB blocks every scan finds mapped, for /proc/procReport_physmap");
+
+static unsigned int phys_sparse_pages = 32; // Of 512 pages in a 2 MiB block
+module_param(phys_sparse_pages, uint, 0644);
+MODULE_PARM_DESC(phys_sparse_pages,
+                 "A 2 MiB block with at most this many mapped pages counts as sparse (pinned but nearly free)");
+
+static unsigned int ring_records;           // 0 = no binary ring buffer
+module_param(ring_records, uint, 0444);
+MODULE_PARM_DESC(ring_records,
+                 "Slots in the mmap()-able binary ring at /dev/procReport (0 = disabled)");
+
+static int vma_bench_pid;                   // 0 = no VMA iteration benchmark
+module_param(vma_bench_pid, int, 0444);
+MODULE_PARM_DESC(vma_bench_pid,
+                 "Time pure VMA iteration over this process at load (see bench/)");
+
+//----------------------------------
+//       KERNEL COMPATIBILITY
+//----------------------------------
+
+// pmd_leaf()/pud_leaf() only became generic in 5.6; older x86 kernels spell
+// the same test pmd_large()/pud_large().
+#ifndef pmd_leaf
+#define pmd_leaf(pmd)   pmd_large(pmd)
+#endif
+#ifndef pud_leaf
+#define pud_leaf(pud)   pud_large(pud)
+#endif
+
+// The mmap_lock wrappers appeared in 5.8; before that it was mmap_sem.
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
+static inline void mmap_read_lock(struct mm_struct *mm)
+{
+    down_read(&mm->mmap_sem);
+}
+
+static inline void mmap_read_unlock(struct mm_struct *mm)
+{
+    up_read(&mm->mmap_sem);
+}
+
+static inline bool mmap_lock_is_contended(struct mm_struct *mm)
+{
+    return rwsem_is_contended(&mm->mmap_sem) != 0;
+}
+
+// ptep_get() also arrived in 5.8; a plain load is what it did back then.
+static inline pte_t ptep_get(pte_t *ptep)
+{
+    return READ_ONCE(*ptep);
+}
+#endif
+
+// VMA iteration. 6.1 replaced mm->mmap and vm_next with the maple tree, so
+// the walker goes through VMA_CURSOR()/for_each_vma_cursor(), which visit
+// every VMA intersecting [addr, end) in ascending order on either kernel.
+// The caller holds mmap_read_lock() for as long as the cursor is used.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
+#define VMA_ITER_KIND   "maple tree"
+#define VMA_CURSOR(name, __mm, __addr)  VMA_ITERATOR(name, __mm, __addr)
+#define for_each_vma_cursor(name, vma, __end) \
+    for_each_vma_range(name, vma, __end)
+#else
+#define VMA_ITER_KIND   "linked list"
+
+struct vma_cursor {
+    struct mm_struct *mm;       // Memory map being iterated
+    unsigned long addr;         // Where the first lookup starts
+    struct vm_area_struct *vma; // Last VMA returned, NULL before the first
+};
+
+#define VMA_CURSOR(name, __mm, __addr) \
+    struct vma_cursor name = { .mm = (__mm), .addr = (__addr), .vma = NULL }
+
+static inline struct vm_area_struct *vma_cursor_next(struct vma_cursor *cur,
+                                                     unsigned long end)
+{
+    struct vm_area_struct *vma;
+
+    vma = cur->vma ? cur->vma->vm_next : find_vma(cur->mm, cur->addr);
+    if (vma && vma->vm_start >= end)
+        vma = NULL;
+    cur->vma = vma;
+    return vma;
+}
+
+#define for_each_vma_cursor(name, vma, __end) \
+    while (((vma) = vma_cursor_next(&(name), (__end))) != NULL)
+#endif
+
+// PDE_DATA() was renamed pde_data() in 5.17.
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0)
+#define pde_data(inode) PDE_DATA(inode)
+#endif
+
+// page_mapcount() is gone in recent kernels; the folio mapcount spread over
+// the folio's pages is the average smaps falls back to as well.
+static inline unsigned int page_share_count(struct page *page)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+    struct folio *folio = page_folio(page);
+    int mapcount = folio_mapcount(folio);
+
+    if (folio_test_large(folio))
+        mapcount = DIV_ROUND_CLOSEST(mapcount, (int)folio_nr_pages(folio));
+    return max(mapcount, 1);
+#else
+    return max(page_mapcount(page), 1);
+#endif
+}
+
+// vm_flags became read-only in 6.3 and must be changed through helpers.
+static inline void vma_clear_flags(struct vm_area_struct *vma, unsigned long flags)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, flags);
+#else
+    vma->vm_flags &= ~flags;
+#endif
+}
+
+//----------------------------------
+//         SCAN STATISTICS
+//----------------------------------
+
+#define LOCK_HOLD_BUCKETS 16    // mmap_lock hold histogram: <1 us, then log2 us
+
+/**
+ * struct scan_stats - Instrumentation counters, shown in debugfs.
+ * @ptes:         PTE slots looked at by all walks.
+ * @holes:        Empty upper-level entries whose whole range was skipped.
+ * @lock_holds:   mmap_read_lock() holds taken by walks.
+ * @lock_hold_ns: Time spent holding them.
+ * @lock_hist:    Holds by duration; bucket 0 is below 1 us, bucket i covers
+ *                2^(i-1) to 2^i us, the last bucket also every longer hold.
+ * @resched:      cond_resched() calls between lock holds.
+ * @walked:       Processes walked; cache hits and shared mms are not.
+ * @walk_ns:      Walk time of those processes, summed over their units.
+ * @walk_max_ns:  Longest walk time of a single process.
+ * @scans:        Reports generated.
+ * @scan_ns:      Total time spent generating them.
+ * @last_scan_ns: Duration of the last report, split into the phases below.
+ * @last_snapshot_ns: Taking the process list.
+ * @last_plan_ns: Deduplicating mms, cache lookups and cutting units.
+ * @last_walk_ns: Walking the units on the worker pool.
+ * @last_merge_ns: Merging unit results and updating the cache.
+ * @last_ptes:    PTE slots looked at during the last walk phase.
+ * @allocs:       Heap allocations made by scans: pool growth, snapshots and
+ *                incremental cache entries.
+ * @pool_reuses:  Scan buffers and snapshots served again without allocating.
+ * @throttle_sleeps: Sleeps taken by throttled walks to stay in budget.
+ * @throttle_ns:  Time spent in those sleeps.
+ * @backoff:      Load backoff factor of the last throttle sleep.
+ * @scan_start_ns: Start of the scan in progress, 0 between scans.
+ * @scan_units:   Units planned for the scan in progress.
+ * @units_done:   Units of it walked so far.
+ *
+ * Walk counters are shared by all workers, so they are atomic and are added
+ * once per walk, never per page. The allocation counters are atomic because
+ * snapshots are recycled from RCU callbacks. The rest is only written under
+ * scan_mutex.
+ */
+struct scan_stats {
+    atomic64_t ptes;
+    atomic64_t holes;
+    atomic64_t lock_holds;
+    atomic64_t lock_hold_ns;
+    atomic64_t lock_hist[LOCK_HOLD_BUCKETS];
+    atomic64_t resched;
+    u64 walked;
+    u64 walk_ns;
+    u64 walk_max_ns;
+    u64 scans;
+    u64 scan_ns;
+    u64 last_scan_ns;
+    u64 last_snapshot_ns;
+    u64 last_plan_ns;
+    u64 last_walk_ns;
+    u64 last_merge_ns;
+    u64 last_ptes;
+    atomic64_t allocs;
+    atomic64_t pool_reuses;
+    atomic64_t throttle_sleeps;
+    atomic64_t throttle_ns;
+    unsigned int backoff;
+    u64 scan_start_ns;
+    unsigned int scan_units;
+    atomic_t units_done;
+};
+
+static struct scan_stats stats;
+
+/**
+ * stats_lock_hold - Account one mmap_read_lock() hold of a walk.
+ * @hold_ns: How long the lock was held.
+ */
+static void stats_lock_hold(u64 hold_ns)
+{
+    u64 us = div_u64(hold_ns, NSEC_PER_USEC);
+    unsigned int bucket = us ? min_t(unsigned int, ilog2(us) + 1, LOCK_HOLD_BUCKETS - 1) : 0;
+
+    atomic64_inc(&stats.lock_holds);
+    atomic64_add(hold_ns, &stats.lock_hold_ns);
+    atomic64_inc(&stats.lock_hist[bucket]);
+}
+
+//----------------------------------
+//         SCAN MEMORY POOL
+//----------------------------------
+
+/**
+ * struct scan_buf - Memory of one per-scan array, kept for the next scan.
+ * @ptr:  The memory, or NULL before the first scan.
+ * @size: Its size in bytes.
+ *
+ * Scans are serialized by scan_mutex, so a single buffer per array is reused
+ * by every scan and only grows when a scan needs more than any before it;
+ * periodic sampling of a stable system then allocates nothing at all.
+ */
+struct scan_buf {
+    void *ptr;
+    size_t size;
+};
+
+// Arrays of the scan in progress, under scan_mutex.
+static struct scan_buf items_buf, units_buf, order_buf, queues_buf, workers_buf;
+
+/**
+ * scan_buf_get - Get at least @size bytes of zeroed memory from @buf.
+ * @buf:  Buffer to take the memory from.
+ * @size: Bytes needed.
+ * @keep: Leading bytes whose contents must survive if @buf has to grow.
+ *
+ * Returns the memory, valid until the next call for @buf, or NULL.
+ */
+static void *scan_buf_get(struct scan_buf *buf, size_t size, size_t keep)
+{
+    void *ptr;
+
+    if (size <= buf->size) {
+        atomic64_inc(&stats.pool_reuses);
+        memset((char *)buf->ptr + keep, 0, size - keep);
+        return buf->ptr;
+    }
+
+    // Grow by at least half, so a slowly rising process count settles fast.
+    size = max(size, buf->size + buf->size / 2);
+    ptr = kvzalloc(size, GFP_KERNEL);
+    if (!ptr)
+        return NULL;
+    atomic64_inc(&stats.allocs);
+    if (keep)
+        memcpy(ptr, buf->ptr, keep);
+    kvfree(buf->ptr);
+    buf->ptr = ptr;
+    buf->size = size;
+    return ptr;
+}
+
+static void scan_buf_free(struct scan_buf *buf)
+{
+    kvfree(buf->ptr);
+    buf->ptr = NULL;
+    buf->size = 0;
+}
+
+//----------------------------------
+//         PAGE-TABLE WALKER
+//----------------------------------
+
+/**
+ * struct page_counts - Per-process page counts produced by the walker.
+ * @total:     Number of allocated pages found.
+ * @contig:    Pages whose physical address directly follows the previous page.
+ * @noncontig: Pages that do not follow the previous page physically.
+ * @huge:      Base pages mapped through PMD/PUD leaf entries or hugetlb VMAs.
+ * @pmd_aligned: PMD-sized blocks lying entirely inside one run, aligned both
+ *             physically and virtually, i.e. mappable by a PMD in place.
+ * @runs:      Histogram of run lengths; bucket i counts runs of 2^i to
+ *             2^(i+1) - 1 pages, the last bucket every longer run too.
+ * @swap:      Pages swapped out (swap PTEs); not part of @total.
+ * @anon:      Anonymous pages of @total.
+ * @file:      File-backed and shmem pages of @total.
+ * @pss:       Proportional set size in pages, fixed point with PSS_SHIFT
+ *             fraction bits; each page counts 1/N when N mappings share it.
+ * @nodes:     Pages of @total per NUMA node; nodes past the last slot are
+ *             added to the last slot.
+ * @sparse_blocks: With phys_map, sparse 2 MiB blocks this process pins,
+ *             filled in after the scan from the physical map.
+ * @sparse_pages: Mapped pages in those blocks.
+ *
+ * Huge mappings are counted in base pages, so @huge is a subset of @total.
+ * Without pss_accounting @anon and @file follow the VMA type (so CoW copies
+ * in private file mappings count as file) and @pss stays 0.
+ * A run is a maximal stretch of pages that are consecutive both physically
+ * and virtually; unlike @contig it ends at a hole in the address space.
+ */
+struct page_counts {
+    unsigned long total;
+    unsigned long contig;
+    unsigned long noncontig;
+    unsigned long huge;
+    unsigned long pmd_aligned;
+    unsigned long runs[PROCREPORT_RUN_BUCKETS];
+    unsigned long swap;
+    unsigned long anon;
+    unsigned long file;
+    u64 pss;
+    unsigned long nodes[PROCREPORT_MAX_NODES];
+    unsigned long sparse_blocks;
+    unsigned long sparse_pages;
+};
+
+#define PSS_SHIFT 12            // Fraction bits of page_counts.pss
+
+/**
+ * struct phys_run - A stretch of physically and virtually consecutive pages.
+ * @phys: Physical address of the first page.
+ * @virt: Virtual address of the first page.
+ * @len:  Length in base pages; 0 for no run.
+ */
+struct phys_run {
+    unsigned long phys;
+    unsigned long virt;
+    unsigned long len;
+};
+
+#define PHYS_BLOCK_PAGES (PMD_SIZE >> PAGE_SHIFT)      // Pages per 2 MiB block
+
+/**
+ * struct phys_block - One 2 MiB block of physical memory in the scan's map.
+ * @refs:  Mappings of pages in the block found by the scan; a page mapped
+ *         by several processes counts once for each.
+ * @owner: Index of the scan item that marked the block last.
+ */
+struct phys_block {
+    atomic_t refs;
+    u32 owner;
+};
+
+// Quantities the sampled walk estimates (index into struct walk_estimate).
+enum { EST_TOTAL, EST_CONTIG, EST_NONCONTIG, EST_NR };
+
+/**
+ * struct walk_estimate - Horvitz-Thompson sums of a sampled walk.
+ * @extra: What the skipped PTE tables are estimated to add to the counts.
+ * @var:   Estimated variance of the resulting estimate.
+ */
+struct walk_estimate {
+    u64 extra[EST_NR];
+    u64 var[EST_NR];
+};
+
+/**
+ * struct walk_state - Running state of a page-table walk over one process.
+ * @counts:    Counts accumulated so far.
+ * @first_phys: Physical address of the first allocated page seen (0 if none yet).
+ * @prev_phys: Physical address of the last allocated page seen (0 if none yet).
+ * @hole_end:  End of the last empty upper-level range found, in user space.
+ * @hugetlb:   The VMA being walked is a hugetlbfs mapping.
+ * @anon:      The VMA being walked is anonymous memory.
+ * @sharing:   pss_accounting was set when the walk started, or the caller
+ *             asked for PSS itself.
+ * @page_info: Look at struct page for the VMA being walked (@sharing, and
+ *             the VMA holds normal pages rather than raw PFNs).
+ * @mm:        Memory map being walked, checked for lock contention.
+ * @deadline_ns: ktime_get_ns() value at which the walk yields (0 = never).
+ * @pmd_batch: PMD entries handled since the deadline was last checked.
+ * @resume:    Address to continue from after yielding (0 = walk completed).
+ * @run:       Run still being extended; not in @counts.runs yet.
+ * @head:      First run of the walk, once it has ended.
+ * @head_done: @head is valid. Until then the first run is still @run.
+ * @nr_ptes:   PTE slots looked at, added to the statistics when done.
+ * @nr_holes:  Empty upper-level entries skipped, likewise.
+ * @node_id:   Node of the last page frame looked up.
+ * @node_start: First PFN spanned by that node.
+ * @node_end:  End of the PFNs spanned by that node (exclusive).
+ * @sample_every: Sampling: one PTE table in this many is walked (0 = exact).
+ * @sample_seed: Sampling: random seed of the walk.
+ * @sample_m:  Sampling: tables per sampled one in the current VMA.
+ * @sample_off: Sampling: slot of each group of @sample_m walked in this VMA.
+ * @sample_base: Sampling: PMD slot number the current VMA starts in.
+ * @est:       Sampling: estimator sums, see walk_pte_sampled().
+ * @phys_blocks: Physical block map to mark the pages in, or NULL.
+ * @phys_nr:   Number of blocks in @phys_blocks.
+ * @phys_owner: Value recorded as owner of the blocks marked.
+ *
+ * The walker carries this state across every VMA of a process so that
+ * contiguity is judged in virtual-address order, exactly as the original
+ * page-by-page loop did. Because VMAs are visited in ascending order, an
+ * absent pgd/p4d/pud/pmd entry also tells us the following VMAs can skip
+ * everything up to @hole_end without descending again.
+ */
+struct walk_state {
+    struct page_counts counts;
+    unsigned long first_phys;
+    unsigned long prev_phys;
+    unsigned long hole_end;
+    bool hugetlb;
+    bool anon;
+    bool sharing;
+    bool page_info;
+    struct mm_struct *mm;
+    u64 deadline_ns;
+    unsigned int pmd_batch;
+    unsigned long resume;
+    struct phys_run run;
+    struct phys_run head;
+    bool head_done;
+    unsigned long nr_ptes;
+    unsigned long nr_holes;
+    int node_id;
+    unsigned long node_start;
+    unsigned long node_end;
+    unsigned int sample_every;
+    u32 sample_seed;
+    unsigned long sample_m;
+    unsigned long sample_off;
+    unsigned long sample_base;
+    struct walk_estimate est;
+    struct phys_block *phys_blocks;
+    unsigned long phys_nr;
+    u32 phys_owner;
+};
+
+#define WALK_PMD_BATCH 8        // PMD entries walked between clock checks
+
+/**
+ * walk_yield - Decide whether the walk should drop mmap_lock at @addr.
+ * @ws:   Walk state; @ws->resume is set to @addr when yielding.
+ * @addr: PMD-aligned address the walk would continue from.
+ *
+ * The clock is only read once per WALK_PMD_BATCH entries, so the check costs
+ * little next to the 512 PTEs a PMD table holds. A writer queued on the lock
+ * also makes us yield early, since it is blocking page faults behind it.
+ */
+static inline bool walk_yield(struct walk_state *ws, unsigned long addr)
+{
+    if (!ws->deadline_ns || ++ws->pmd_batch < WALK_PMD_BATCH)
+        return false;
+    ws->pmd_batch = 0;
+
+    if (ktime_get_ns() < ws->deadline_ns && !mmap_lock_is_contended(ws->mm))
+        return false;
+
+    ws->resume = addr;
+    return true;
+}
+
+/**
+ * note_hole - Remember that the page-table level covering @addr is empty.
+ * @ws:   Walk state to update.
+ * @addr: Address whose upper-level entry was none or bad.
+ * @mask: Address mask of that level (PGDIR_MASK, P4D_MASK, PUD_MASK, PMD_MASK).
+ *
+ * The hole extends to the next boundary of that level, which may lie past
+ * the end of the VMA currently being walked.
+ */
+static inline void note_hole(struct walk_state *ws, unsigned long addr,
+                             unsigned long mask)
+{
+    unsigned long boundary = (addr & mask) + ~mask + 1;
+
+    // An entry at the very top of the address space wraps around to 0.
+    ws->hole_end = boundary ? boundary : ULONG_MAX;
+    ws->nr_holes++;
+}
+
+/**
+ * run_add - Add a finished run to the histogram, or take it back out.
+ * @counts: Counts holding the histogram.
+ * @run:    Finished run; nothing happens if it is empty.
+ * @sign:   1 to add the run, -1 to remove it again.
+ */
+static void run_add(struct page_counts *counts, const struct phys_run *run, long sign)
+{
+    unsigned long start, end;
+
+    if (!run->len)
+        return;
+    counts->runs[min_t(unsigned int, ilog2(run->len), PROCREPORT_RUN_BUCKETS - 1)] += sign;
+
+    // A PMD can only map the run in place where both addresses share the
+    // same offset within a 2 MiB block.
+    if ((run->phys ^ run->virt) & ~PMD_MASK)
+        return;
+    start = ALIGN(run->phys, PMD_SIZE);
+    end = ALIGN_DOWN(run->phys + run->len * PAGE_SIZE, PMD_SIZE);
+    if (end > start)
+        counts->pmd_aligned += sign * (long)((end - start) >> PMD_SHIFT);
+}
+
+/**
+ * run_continues - Check whether @next starts right where @run ends.
+ */
+static inline bool run_continues(const struct phys_run *run, unsigned long phys,
+                                 unsigned long virt)
+{
+    return run->len && phys == run->phys + run->len * PAGE_SIZE &&
+           virt == run->virt + run->len * PAGE_SIZE;
+}
+
+/**
+ * run_end - Close the run being extended and add it to the histogram.
+ * @ws: Walk state whose @ws->run ended.
+ *
+ * The first run of a walk is remembered separately, because
+ * merge_walk_state() may still join it with the range before.
+ */
+static void run_end(struct walk_state *ws)
+{
+    if (!ws->run.len)
+        return;
+    if (!ws->head_done) {
+        ws->head = ws->run;
+        ws->head_done = true;
+    }
+    run_add(&ws->counts, &ws->run, 1);
+    ws->run.len = 0;
+}
+
+/**
+ * account_pages - Split a run into anon/file pages and add its PSS share.
+ * @ws:   Walk state to update.
+ * @pfn:  First page frame of the run.
+ * @nr:   Number of base pages in the run.
+ * @huge: The run is one huge page, so its head page speaks for all of it.
+ *
+ * Only with @ws->page_info is the struct page looked at; otherwise the VMA
+ * type decides and no memory beyond the page table is touched.
+ */
+static void account_pages(struct walk_state *ws, unsigned long pfn,
+                          unsigned long nr, bool huge)
+{
+    unsigned long i, step = huge ? nr : 1;
+
+    if (!ws->page_info) {
+        if (ws->anon)
+            ws->counts.anon += nr;
+        else
+            ws->counts.file += nr;
+        return;
+    }
+
+    for (i = 0; i < nr; i += step) {
+        struct page *page;
+
+        // The shared zero page is not memory the process owns (smaps skips
+        // it too), and frames without a struct page have no mapcount.
+        if (is_zero_pfn(pfn + i) || !pfn_valid(pfn + i)) {
+            if (ws->anon)
+                ws->counts.anon += step;
+            else
+                ws->counts.file += step;
+            continue;
+        }
+        page = pfn_to_page(pfn + i);
+        if (PageAnon(page))
+            ws->counts.anon += step;
+        else
+            ws->counts.file += step;
+        ws->counts.pss += ((u64)step << PSS_SHIFT) / page_share_count(page);
+    }
+}
+
+/**
+ * account_nodes - Add a run of page frames to the per-node counts.
+ * @ws:  Walk state to update.
+ * @pfn: First page frame of the run.
+ * @nr:  Number of page frames.
+ *
+ * pfn_to_nid() reads the struct page flags on most configurations, so the
+ * PFN span of the node found last is remembered and frames inside it are
+ * counted without a lookup. Nodes span long PFN ranges, so in practice only
+ * the first frame of a walk and frames on another node pay for one.
+ */
+static void account_nodes(struct walk_state *ws, unsigned long pfn, unsigned long nr)
+{
+    while (nr) {
+        unsigned long n;
+
+        if (pfn < ws->node_start || pfn >= ws->node_end) {
+            if (!pfn_valid(pfn))
+                return;         // Raw device frame, on no node
+            ws->node_id = pfn_to_nid(pfn);
+            ws->node_start = node_start_pfn(ws->node_id);
+            ws->node_end = node_end_pfn(ws->node_id);
+            if (pfn < ws->node_start || pfn >= ws->node_end) {
+                ws->node_end = pfn + 1;     // Outside its own span; look up per frame
+                ws->node_start = pfn;
+            }
+        }
+        n = min(nr, ws->node_end - pfn);
+        ws->counts.nodes[min(ws->node_id, PROCREPORT_MAX_NODES - 1)] += n;
+        pfn += n;
+        nr -= n;
+    }
+}
+
+/**
+ * account_blocks - Mark a run of page frames in the physical block map.
+ * @ws:  Walk state with a map.
+ * @pfn: First page frame of the run.
+ * @nr:  Number of page frames.
+ *
+ * Workers mark the shared map concurrently, hence one atomic add per block
+ * the run touches; a run is rarely longer than one block.
+ */
+static void account_blocks(struct walk_state *ws, unsigned long pfn, unsigned long nr)
+{
+    while (nr) {
+        unsigned long block = pfn / PHYS_BLOCK_PAGES;
+        unsigned long n = min(nr, PHYS_BLOCK_PAGES - pfn % PHYS_BLOCK_PAGES);
+
+        if (block >= ws->phys_nr)
+            return;             // Device memory above the last node
+        atomic_add(n, &ws->phys_blocks[block].refs);
+        WRITE_ONCE(ws->phys_blocks[block].owner, ws->phys_owner);
+        pfn += n;
+        nr -= n;
+    }
+}
+
+/**
+ * record_frames - Account the frames of a run, but not their contiguity.
+ * @ws:   Walk state to update.
+ * @phys: Physical address of the first page of the run.
+ * @addr: Virtual address of the first page of the run.
+ * @nr:   Number of base pages in the run (at least 1).
+ * @huge: The run is mapped by a huge page.
+ *
+ * Extends the run histogram and adds the page types, nodes and physical
+ * blocks of the run. Page totals are left to record_contig().
+ */
+static inline void record_frames(struct walk_state *ws, unsigned long phys,
+                                 unsigned long addr, unsigned long nr, bool huge)
+{
+    if (run_continues(&ws->run, phys, addr)) {
+        ws->run.len += nr;
+    } else {
+        run_end(ws);
+        ws->run.phys = phys;
+        ws->run.virt = addr;
+        ws->run.len = nr;
+    }
+
+    account_pages(ws, phys >> PAGE_SHIFT, nr, huge);
+    account_nodes(ws, phys >> PAGE_SHIFT, nr);
+    if (ws->phys_blocks)
+        account_blocks(ws, phys >> PAGE_SHIFT, nr);
+}
+
+/**
+ * record_contig - Add pages of known contiguity to the totals.
+ * @ws:       Walk state to update.
+ * @first:    Physical address of the first of the pages.
+ * @last:     Physical address of the last of the pages.
+ * @present:  Number of pages (at least 1).
+ * @adjacent: Pages after the first that directly follow the page before.
+ * @huge:     The pages are mapped by huge pages.
+ *
+ * Only the first page is compared with the page before; for the others
+ * the caller already counted how many are contiguous.
+ */
+static inline void record_contig(struct walk_state *ws, unsigned long first,
+                                 unsigned long last, unsigned long present,
+                                 unsigned long adjacent, bool huge)
+{
+    ws->counts.total += present;
+    if (huge)
+        ws->counts.huge += present;
+
+    // The very first page has nothing to compare against; it is classified
+    // once the walk has finished (see merge_walk_state() and finish_counts()).
+    if (ws->prev_phys != 0) {
+        if (first == ws->prev_phys + PAGE_SIZE)
+            ws->counts.contig++;
+        else
+            ws->counts.noncontig++;
+    } else {
+        ws->first_phys = first;
+    }
+    ws->counts.contig += adjacent;
+    ws->counts.noncontig += present - 1 - adjacent;
+    ws->prev_phys = last;
+}
+
+/**
+ * record_run - Account a run of physically consecutive pages in O(1).
+ * @ws:   Walk state to update.
+ * @phys: Physical address of the first page of the run.
+ * @addr: Virtual address of the first page of the run.
+ * @nr:   Number of base pages in the run (at least 1).
+ * @huge: The run is mapped by a huge page.
+ *
+ * Only the first page of a run needs comparing with the previous page; the
+ * remaining @nr - 1 pages are contiguous by construction. Run lengths are
+ * tracked in the same step, so the histogram costs no extra pass.
+ */
+static inline void record_run(struct walk_state *ws, unsigned long phys,
+                              unsigned long addr, unsigned long nr, bool huge)
+{
+    record_frames(ws, phys, addr, nr, huge);
+    record_contig(ws, phys, phys + (nr - 1) * PAGE_SIZE, nr, nr - 1, huge);
+}
+
+/**
+ * huge_leaf_phys - Physical address mapped at @addr by a huge leaf entry.
+ * @pfn:  First page frame of the huge page.
+ * @addr: Virtual address inside the huge page.
+ * @mask: Address mask of the level holding the leaf (PMD_MASK or PUD_MASK).
+ */
+static inline unsigned long huge_leaf_phys(unsigned long pfn, unsigned long addr,
+                                           unsigned long mask)
+{
+    return (pfn << PAGE_SHIFT) + (addr & ~mask);
+}
+
+/**
+ * pte_run_length - Count the entries after @pte that continue its frame run.
+ * @pte: First entry of the run; present.
+ * @pfn: Page frame @pte maps.
+ * @max: Number of entries from @pte to the end of the table slice.
+ *
+ * A plain scalar loop that loads one entry at a time and stops at the first
+ * one that is not present or does not map the next frame. The flag bits of
+ * neighbouring entries differ (accessed, dirty), so the raw values cannot
+ * be compared word-parallel. It does no accounting itself; the caller
+ * handles each run as a whole.
+ *
+ * Returns the run length in entries, at least 1.
+ */
+static inline unsigned int pte_run_length(pte_t *pte, unsigned long pfn, unsigned int max)
+{
+    unsigned int n;
+
+    for (n = 1; n < max; n++) {
+        pte_t ptent = ptep_get(pte + n);
+
+        if (!pte_present(ptent) || pte_pfn(ptent) != pfn + n)
+            break;
+    }
+    return n;
+}
+
+/**
+ * walk_pte_range - Account every PTE of one PMD table between @addr and @end.
+ *
+ * The whole table is mapped once with pte_offset_map() and scanned in a
+ * tight loop instead of re-walking from the PGD for each page. Contiguity
+ * only needs the PFN, which sits in the PTE itself. The struct page behind
+ * a frame is read in two cases: by account_nodes(), when the frame lies
+ * outside the node span it remembered, and by account_pages() for every
+ * page when pss_accounting is set.
+ *
+ * Consecutive frames are gathered by pte_run_length(), and only frame
+ * accounting is done per run. Present, adjacent and swapped entries are
+ * summed in locals and added to @ws once per table, so the per-page work in
+ * the loop is a load, a flag test and a PFN compare.
+ */
+static void walk_pte_range(struct walk_state *ws, pmd_t *pmd,
+                           unsigned long addr, unsigned long end)
+{
+    pte_t *start_pte;           // First mapped PTE, needed for pte_unmap()
+    unsigned int nr = (end - addr) >> PAGE_SHIFT;   // Entries in the slice
+    unsigned int i = 0, present = 0, adjacent = 0, swap = 0;
+    unsigned long first_pfn = 0, last_pfn = 0;
+
+    start_pte = pte_offset_map(pmd, addr);
+    if (!start_pte)
+        return;                 // Table vanished under us (6.x can fail here)
+    ws->nr_ptes += nr;
+
+    while (i < nr) {
+        pte_t ptent = ptep_get(start_pte + i);
+        unsigned long pfn;
+        unsigned int run;
+
+        // Empty, swapped out, or a migration entry: no page frame behind it.
+        if (!pte_present(ptent)) {
+            if (!pte_none(ptent) && !non_swap_entry(pte_to_swp_entry(ptent)))
+                swap++;
+            i++;
+            continue;
+        }
+        pfn = pte_pfn(ptent);
+        run = pte_run_length(start_pte + i, pfn, nr - i);
+        record_frames(ws, pfn << PAGE_SHIFT, addr + ((unsigned long)i << PAGE_SHIFT),
+                      run, ws->hugetlb);
+
+        // A run can continue the previous one across non-present entries.
+        if (!present)
+            first_pfn = pfn;
+        else if (pfn == last_pfn + 1)
+            adjacent++;
+        present += run;
+        adjacent += run - 1;
+        last_pfn = pfn + run - 1;
+        i += run;
+    }
+
+    pte_unmap(start_pte);
+    ws->counts.swap += swap;
+    if (present)
+        record_contig(ws, first_pfn << PAGE_SHIFT, last_pfn << PAGE_SHIFT,
+                      present, adjacent, ws->hugetlb);
+}
+
+/**
+ * walk_pte_sampled - Walk the PTE table at @addr if the sample picks it.
+ *
+ * Every VMA is a stratum cut into groups of @ws->sample_m consecutive PMD
+ * slots, and one slot per group, at a random offset drawn per VMA, has its
+ * PTE table walked. Each slot thus has a 1/m chance to be walked, so adding
+ * m times what a walked table holds is an unbiased (Horvitz-Thompson)
+ * estimate of the whole VMA, whichever slots happened to be empty, huge or
+ * skipped as holes. Its variance is estimated by (m^2 - m) y^2 summed over
+ * the walked tables, which is conservative for systematic samples.
+ *
+ * Huge leaves are cheap and always counted exactly by the caller. Only
+ * pairs of pages within the table are judged: the page walked before it
+ * lies in an earlier sampled table, usually far away, and comparing with it
+ * would add about m false noncontig pages per table. The table's first page
+ * is instead counted as whatever most pairs within the table are (noncontig
+ * on a tie), which is exact unless the table changes character right at its
+ * boundary.
+ */
+static void walk_pte_sampled(struct walk_state *ws, pmd_t *pmd,
+                             unsigned long addr, unsigned long end)
+{
+    unsigned long m = ws->sample_m;
+    unsigned long prev_phys = ws->prev_phys;
+    unsigned long first_phys = ws->first_phys;
+    struct page_counts before;
+    u64 y[EST_NR];
+    int i;
+
+    if (((addr >> PMD_SHIFT) - ws->sample_base) % m != ws->sample_off)
+        return;
+
+    before.total = ws->counts.total;
+    before.contig = ws->counts.contig;
+    before.noncontig = ws->counts.noncontig;
+    ws->prev_phys = 0;          // record_run() leaves the first page unjudged
+    walk_pte_range(ws, pmd, addr, end);
+    y[EST_TOTAL] = ws->counts.total - before.total;
+    y[EST_CONTIG] = ws->counts.contig - before.contig;
+    y[EST_NONCONTIG] = ws->counts.noncontig - before.noncontig;
+
+    if (!ws->prev_phys) {
+        ws->prev_phys = prev_phys;          // Nothing mapped in the table
+    } else if (prev_phys) {
+        // Not the first page of the walk, which finish_counts() judges.
+        ws->first_phys = first_phys;
+        i = y[EST_CONTIG] > y[EST_NONCONTIG] ? EST_CONTIG : EST_NONCONTIG;
+        if (i == EST_CONTIG)
+            ws->counts.contig++;
+        else
+            ws->counts.noncontig++;
+        y[i]++;
+    }
+
+    for (i = 0; i < EST_NR; i++) {
+        ws->est.extra[i] += (m - 1) * y[i];
+        ws->est.var[i] += (m * m - m) * y[i] * y[i];
+    }
+}
+
+/**
+ * walk_pmd_range - Descend into every PTE table referenced by a PUD entry.
+ */
+static void walk_pmd_range(struct walk_state *ws, pud_t *pud,
+                           unsigned long addr, unsigned long end)
+{
+    pmd_t *pmd = pmd_offset(pud, addr);
+    unsigned long next;
+
+    do {
+        pmd_t pmdval = *pmd;    // Snapshot; the entry may change under us
+
+        next = pmd_addr_end(addr, end);
+        if (pmd_none(pmdval)) {
+            note_hole(ws, addr, PMD_MASK); // Nothing mapped below this entry
+            continue;
+        }
+        if (!pmd_present(pmdval))
+            continue;           // Huge page under migration, nothing resident
+        if (pmd_trans_huge(pmdval) || pmd_leaf(pmdval)) {
+            // A 2 MiB leaf (THP or hugetlb): account it without a PTE table.
+            record_run(ws, huge_leaf_phys(pmd_pfn(pmdval), addr, PMD_MASK), addr,
+                       (next - addr) >> PAGE_SHIFT, true);
+            continue;
+        }
+        if (pmd_bad(pmdval)) {
+            note_hole(ws, addr, PMD_MASK);
+            continue;
+        }
+        if (unlikely(ws->sample_m > 1))
+            walk_pte_sampled(ws, pmd, addr, next);
+        else
+            walk_pte_range(ws, pmd, addr, next);
+    } while (pmd++, addr = next, addr != end && !walk_yield(ws, addr));
+}
+
+/**
+ * walk_pud_range - Descend into every PMD table referenced by a P4D entry.
+ */
+static void walk_pud_range(struct walk_state *ws, p4d_t *p4d,
+                           unsigned long addr, unsigned long end)
+{
+    pud_t *pud = pud_offset(p4d, addr);
+    unsigned long next;
+
+    do {
+        pud_t pudval = *pud;
+
+        next = pud_addr_end(addr, end);
+        if (pud_none(pudval)) {
+            note_hole(ws, addr, PUD_MASK);
+            continue;
+        }
+        if (pud_leaf(pudval)) {
+            // A 1 GiB leaf: 262,144 base pages accounted in one step.
+            if (pud_present(pudval))
+                record_run(ws, huge_leaf_phys(pud_pfn(pudval), addr, PUD_MASK),
+                           addr, (next - addr) >> PAGE_SHIFT, true);
+            continue;
+        }
+        if (pud_bad(pudval)) {
+            note_hole(ws, addr, PUD_MASK);
+            continue;
+        }
+        walk_pmd_range(ws, pud, addr, next);
+        if (ws->resume)
+            return;             // Yielded; the caller drops mmap_lock
+    } while (pud++, addr = next, addr != end);
+}
+
+/**
+ * walk_p4d_range - Descend into every PUD table referenced by a PGD entry.
+ */
+static void walk_p4d_range(struct walk_state *ws, pgd_t *pgd,
+                           unsigned long addr, unsigned long end)
+{
+    p4d_t *p4d = p4d_offset(pgd, addr);
+    unsigned long next;
+
+    do {
+        next = p4d_addr_end(addr, end);
+        if (p4d_none(*p4d) || p4d_bad(*p4d)) {
+            note_hole(ws, addr, P4D_MASK);
+            continue;
+        }
+        walk_pud_range(ws, p4d, addr, next);
+        if (ws->resume)
+            return;
+    } while (p4d++, addr = next, addr != end);
+}
+
+/**
+ * walk_page_tables - Walk the page tables of @mm for [@addr, @end).
+ * @ws:   Walk state that accumulates the counts.
+ * @mm:   Memory map whose page tables are walked.
+ * @addr: Page-aligned start of the range.
+ * @end:  Page-aligned end of the range (exclusive).
+ *
+ * Each upper level is descended a single time per entry, so the cost scales
+ * with the number of page-table entries touched rather than with 4-5 pointer
+ * chases for every page in the range. An absent upper-level entry skips its
+ * whole range at once, and any part of [@addr, @end) already known to be
+ * empty from an earlier VMA is not looked at again.
+ */
+static void walk_page_tables(struct walk_state *ws, struct mm_struct *mm,
+                             unsigned long addr, unsigned long end)
+{
+    pgd_t *pgd;
+    unsigned long next;
+
+    // Jump over the part of the range covered by a hole already found.
+    if (addr < ws->hole_end)
+        addr = min(ws->hole_end, end);
+    if (addr >= end)
+        return;
+
+    pgd = pgd_offset(mm, addr);
+    do {
+        next = pgd_addr_end(addr, end);
+        if (pgd_none(*pgd) || pgd_bad(*pgd)) {
+            note_hole(ws, addr, PGDIR_MASK);
+            continue;
+        }
+        walk_p4d_range(ws, pgd, addr, next);
+        if (ws->resume)
+            return;
+    } while (pgd++, addr = next, addr != end);
+}
+
+/**
+ * walk_mm_range - Walk every VMA of @mm that intersects [@start, @end).
+ * @ws:    Walk state that accumulates the counts.
+ * @mm:    Memory map to walk; the caller holds mmap_read_lock().
+ * @start: Start of the range.
+ * @end:   End of the range (exclusive).
+ *
+ * VMAs straddling the range boundaries are clipped, so adjacent ranges can
+ * be walked independently and later merged with merge_walk_state().
+ */
+static void walk_mm_range(struct walk_state *ws, struct mm_struct *mm,
+                          unsigned long start, unsigned long end)
+{
+    struct vm_area_struct *area;            // Used to walk the VM areas
+    VMA_CURSOR(vmi, mm, start);
+
+    for_each_vma_cursor(vmi, area, end) {
+        trace_procreport_vma(mm, max(area->vm_start, start), min(area->vm_end, end),
+                             area->vm_flags);
+        ws->hugetlb = is_vm_hugetlb_page(area);
+        ws->anon = vma_is_anonymous(area);
+        ws->page_info = ws->sharing && !(area->vm_flags & (VM_IO | VM_PFNMAP));
+        if (ws->sample_every) {
+            // One stratum per VMA; the offset is drawn from the VMA start so
+            // it stays the same when a batched walk comes back to the VMA.
+            ws->sample_base = area->vm_start >> PMD_SHIFT;
+            ws->sample_m = min_t(unsigned long, ws->sample_every,
+                                 ((area->vm_end - 1) >> PMD_SHIFT) - ws->sample_base + 1);
+            ws->sample_off = hash_64(area->vm_start ^ ws->sample_seed, 32) % ws->sample_m;
+        }
+        walk_page_tables(ws, mm, max(area->vm_start, start),
+                         min(area->vm_end, end));
+        if (ws->resume)
+            return;
+    }
+}
+
+#define THROTTLE_SLICE_US 1000     // Lock hold of a throttled walk without lock_hold_us
+#define THROTTLE_MIN_SLEEP_US 100  // Shorter debts are carried to the next batch
+#define THROTTLE_MAX_BACKOFF 8
+#define THROTTLE_MSLEEP_US 20000   // Sleep longer ones with msleep()
+
+static atomic_t throttle_walkers;   // Throttled walks running right now
+
+/**
+ * scan_throttle - Sleep off the CPU time a throttled walk has used.
+ * @debt_ns: Sleep owed so far by this walk; what is slept is taken off.
+ * @busy_ns: CPU time of the batch just walked.
+ * @final:   Last batch of the walk, pay any debt left.
+ *
+ * scan_cpu_permille is a budget for the module as a whole, so it is split
+ * evenly between the throttled walks running at the time: workers of a
+ * parallel scan, streamed rows, on-demand requests and per-VMA reports
+ * alike. With N of them, sleeping (1000 * N - scan_cpu_permille) /
+ * scan_cpu_permille times as long as a walk ran keeps each at 1/N of the
+ * budget. With scan_backoff the sleep grows by the 1-minute load average
+ * per online CPU, up to THROTTLE_MAX_BACKOFF times, so tenants that pile up
+ * work on the run queues get the CPU back. PSI totals are not available to
+ * modules.
+ */
+static void scan_throttle(u64 *debt_ns, u64 busy_ns, bool final)
+{
+    unsigned int permille = READ_ONCE(scan_cpu_permille);
+    unsigned int walkers = max(atomic_read(&throttle_walkers), 1);
+    unsigned int backoff = 1;
+    u64 us;
+
+    if (!permille || permille >= 1000)
+        return;
+
+    if (READ_ONCE(scan_backoff)) {
+        unsigned long load = avenrun[0] >> FSHIFT;
+
+        backoff = clamp_t(unsigned long, 1 + load / num_online_cpus(), 1,
+                          THROTTLE_MAX_BACKOFF);
+    }
+    WRITE_ONCE(stats.backoff, backoff);
+
+    *debt_ns += div_u64(busy_ns * (1000ULL * walkers - permille), permille) * backoff;
+    us = div_u64(*debt_ns, NSEC_PER_USEC);
+    if (us < THROTTLE_MIN_SLEEP_US && !(final && us))
+        return;
+
+    // usleep_range() is for short sleeps; a loaded machine can ask for
+    // seconds, which jiffies resolution handles well enough.
+    if (us > THROTTLE_MSLEEP_US)
+        msleep(DIV_ROUND_UP(us, USEC_PER_MSEC));
+    else
+        usleep_range(us, us + us / 8);
+    atomic64_inc(&stats.throttle_sleeps);
+    atomic64_add(*debt_ns, &stats.throttle_ns);
+    *debt_ns = 0;
+}
+
+/**
+ * walk_mm_range_batched - Walk [@start, @end) of @mm in bounded lock holds.
+ * @ws:    Walk state that accumulates the counts.
+ * @mm:    Pinned memory map to walk; mmap_lock is taken here.
+ * @start: Start of the range.
+ * @end:   End of the range (exclusive).
+ *
+ * Holding mmap_read_lock() for a whole 100 GB walk would stall page faults
+ * and mmap() in the target for seconds, so the lock is only held for about
+ * lock_hold_us at a time. After each batch the lock is dropped, others get a
+ * chance to run, and the walk resumes from the saved address with the VMA
+ * looked up again, since the address space may have changed meanwhile.
+ * A throttled walk (scan_cpu_permille) also sleeps between the batches,
+ * and counts in throttle_walkers while it runs.
+ */
+static void walk_mm_range_batched(struct walk_state *ws, struct mm_struct *mm,
+                                  unsigned long start, unsigned long end)
+{
+    unsigned long addr = start;
+    unsigned int hold_us = READ_ONCE(lock_hold_us);
+    bool throttled = READ_ONCE(scan_cpu_permille);
+    u64 debt_ns = 0;            // Throttle sleep owed
+
+    // A throttled walk must come up for air to sleep.
+    if (throttled && !hold_us)
+        hold_us = THROTTLE_SLICE_US;
+    if (throttled)
+        atomic_inc(&throttle_walkers);
+
+    ws->mm = mm;
+    ws->sharing = ws->sharing || READ_ONCE(pss_accounting);
+    while (addr < end) {
+        u64 locked_ns, hold_ns;
+
+        mmap_read_lock(mm);
+        locked_ns = ktime_get_ns();
+        ws->resume = 0;
+        ws->hole_end = 0;       // Holes seen before unlocking may be filled now
+        ws->deadline_ns = hold_us ? locked_ns + (u64)hold_us * NSEC_PER_USEC : 0;
+        walk_mm_range(ws, mm, addr, end);
+        mmap_read_unlock(mm);
+
+        hold_ns = ktime_get_ns() - locked_ns;
+        stats_lock_hold(hold_ns);
+        trace_procreport_lock_hold(mm, hold_ns, ws->resume != 0);
+
+        scan_throttle(&debt_ns, hold_ns, !ws->resume);
+        if (!ws->resume)
+            break;
+        addr = ws->resume;
+        cond_resched();
+        atomic64_inc(&stats.resched);
+    }
+    if (throttled)
+        atomic_dec(&throttle_walkers);
+
+    atomic64_add(ws->nr_ptes, &stats.ptes);
+    atomic64_add(ws->nr_holes, &stats.holes);
+    ws->nr_ptes = 0;
+    ws->nr_holes = 0;
+}
+
+/**
+ * page_counts_add - Add the counts and histogram of @src to @dst.
+ */
+static void page_counts_add(struct page_counts *dst, const struct page_counts *src)
+{
+    unsigned int i;
+
+    dst->total       += src->total;
+    dst->contig      += src->contig;
+    dst->noncontig   += src->noncontig;
+    dst->huge        += src->huge;
+    dst->pmd_aligned += src->pmd_aligned;
+    dst->swap        += src->swap;
+    dst->anon        += src->anon;
+    dst->file        += src->file;
+    dst->pss         += src->pss;
+    for (i = 0; i < PROCREPORT_MAX_NODES; i++)
+        dst->nodes[i] += src->nodes[i];
+    dst->sparse_blocks += src->sparse_blocks;
+    dst->sparse_pages += src->sparse_pages;
+    for (i = 0; i < PROCREPORT_RUN_BUCKETS; i++)
+        dst->runs[i] += src->runs[i];
+}
+
+/**
+ * struct walk_merge - Where the ranges merged into a process total ended.
+ * @prev_phys: Last physical address seen by the ranges merged so far (0 if none).
+ * @run:       Run still open at the end of those ranges.
+ */
+struct walk_merge {
+    unsigned long prev_phys;
+    struct phys_run run;
+};
+
+/**
+ * merge_walk_state - Append the result of a range walk to a process total.
+ * @counts: Process counts being assembled, in address order.
+ * @mg:     Merge state of the ranges appended so far.
+ * @ws:     Walk state of the next range.
+ *
+ * The first page of @ws was compared with nothing while it was walked; now
+ * that the preceding range is known it is classified the same way the serial
+ * walk would have done it, which keeps the split result exact. A run can
+ * straddle the boundary as well: then the open run before it and the first
+ * run of @ws are counted as one, again exactly as the serial walk would.
+ * A range with nothing resident still adds its swap entries.
+ */
+static void merge_walk_state(struct page_counts *counts, struct walk_merge *mg,
+                             const struct walk_state *ws)
+{
+    const struct phys_run *head = ws->head_done ? &ws->head : &ws->run;
+
+    page_counts_add(counts, &ws->counts);
+    if (ws->counts.total == 0)
+        return;                         // Nothing resident to stitch
+
+    if (mg->prev_phys != 0) {
+        if (ws->first_phys == mg->prev_phys + PAGE_SIZE)
+            counts->contig++;
+        else
+            counts->noncontig++;
+    }
+    mg->prev_phys = ws->prev_phys;
+
+    if (!run_continues(&mg->run, head->phys, head->virt)) {
+        run_add(counts, &mg->run, 1);
+        mg->run = ws->run;
+    } else if (ws->head_done) {
+        // The head ended inside @ws and was counted there on its own.
+        run_add(counts, head, -1);
+        mg->run.len += head->len;
+        run_add(counts, &mg->run, 1);
+        mg->run = ws->run;
+    } else {
+        mg->run.len += head->len;   // @ws is one run, still open
+    }
+}
+
+/**
+ * finish_counts - Classify the first page of a process once its walk is done.
+ * @counts: Process counts to finalize.
+ * @mg:     Merge state of all its ranges; its open run is closed here.
+ */
+static void finish_counts(struct page_counts *counts, struct walk_merge *mg)
+{
+    // The very first valid page encountered in the entire region has no
+    // predecessor, so mark it as non-contiguous by default.
+    if (counts->total > 0)
+        counts->noncontig++;
+    run_add(counts, &mg->run, 1);
+    memset(mg, 0, sizeof(*mg));
+}
+
+/**
+ * finish_walk - Turn a walk of a whole range into its final counts.
+ * @ws:     Walk state of a walk that was not split.
+ * @counts: Filled with the result.
+ */
+static void finish_walk(const struct walk_state *ws, struct page_counts *counts)
+{
+    struct walk_merge mg = { 0 };
+
+    memset(counts, 0, sizeof(*counts));
+    merge_walk_state(counts, &mg, ws);
+    finish_counts(counts, &mg);
+}
+
+/**
+ * count_allocated_pages - Count physical pages for a given process.
+ * @task:   Pointer to the process's task_struct, referenced by the caller.
+ * @ws:     Walk state with its options (sharing, sampling) set, else zeroed.
+ * @counts: Filled with the page counts of the process.
+ *
+ * This function walks the page tables behind each virtual memory area (VMA)
+ * of the process's memory map once, range by range, and counts every page
+ * that resolves to a physical address. Huge mappings are counted as the
+ * number of base pages they cover. @ws is left as the walk ended, for callers
+ * that want more than the counts.
+ *
+ * Returns false, with @counts zeroed, if the task has no memory map.
+ */
+static bool count_allocated_pages(struct task_struct *task, struct walk_state *ws,
+                                  struct page_counts *counts)
+{
+    struct mm_struct *mm;
+
+    // Pin the memory map so it cannot be torn down if the task exits while
+    // we (possibly on another CPU) are walking it. Kernel threads have none.
+    mm = get_task_mm(task);
+    if (mm) {
+        walk_mm_range_batched(ws, mm, 0, TASK_SIZE);
+        mmput(mm);
+    }
+
+    finish_walk(ws, counts);
+    return mm != NULL;
+}
+
+//----------------------------------
+//          SCAN TARGETS
+//----------------------------------
+
+// Serializes scans. It also protects everything a scan reads or updates on
+// the way: the targets below, the incremental cache and snapshot publishing.
+static DEFINE_MUTEX(scan_mutex);
+
+// Also protects the targets, for readers that must not wait for a scan:
+// changing them takes scan_mutex and then this, so holding either one is
+// enough to read them.
+static DEFINE_MUTEX(targets_lock);
+
+#define SCAN_MAX_PIDS 64        // Longest explicit target_pids list
+
+/**
+ * struct scan_targets - Which processes the next scans report on.
+ * @pids:     Explicit process IDs; when set, only these are looked up.
+ * @nr_pids:  Number of entries in @pids.
+ * @pids_ns:  PID namespace @pids are numbers in: that of the writer, or NULL.
+ * @comm:     Only report processes whose name starts with this prefix.
+ * @comm_len: Length of @comm, 0 for no name filter.
+ * @cgrp:     Only report processes in this cgroup v2 subtree, or NULL.
+ * @cgrp_path: Path @cgrp was looked up by, as given by the user.
+ * @pidns:    Only report processes visible in this PID namespace, or NULL.
+ * @pidns_pid: Process whose namespace @pidns is, as given by the user.
+ *
+ * All filters combine; min_pid applies unless an explicit list is given.
+ * Written under scan_mutex and targets_lock, read under either.
+ */
+struct scan_targets {
+    pid_t pids[SCAN_MAX_PIDS];
+    unsigned int nr_pids;
+    struct pid_namespace *pids_ns;
+    char comm[TASK_COMM_LEN];
+    size_t comm_len;
+    struct cgroup *cgrp;
+    char cgrp_path[PATH_MAX];
+    struct pid_namespace *pidns;
+    int pidns_pid;
+};
+
+static struct scan_targets targets;
+
+static int min_pid = 650;           // Historical default: skip early system tasks
+module_param(min_pid, int, 0644);
+MODULE_PARM_DESC(min_pid, "Only report processes with a PID above this (default 650)");
+
+// PIDs are numbers in the PID namespace of the process writing them, as
+// with /dev/procReport_ctl requests, so a container can name its own
+// processes. That namespace is pinned until the list is replaced.
+static int target_pids_set(const char *val, const struct kernel_param *kp)
+{
+    pid_t pids[SCAN_MAX_PIDS];
+    struct pid_namespace *ns, *old;
+    unsigned int nr = 0;
+    char *buf, *cur, *tok;
+    unsigned int i;
+    int ret = 0;
+
+    buf = kstrdup(val, GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+
+    // Comma- or space-separated list; an empty string clears it.
+    cur = strim(buf);
+    while (!ret && (tok = strsep(&cur, ", ")) != NULL) {
+        if (!*tok)
+            continue;
+        if (nr == SCAN_MAX_PIDS)
+            ret = -E2BIG;
+        else
+            ret = kstrtoint(tok, 10, &pids[nr++]);
+    }
+    kfree(buf);
+    if (ret)
+        return ret;
+
+    // A repeated PID would be reported, and scanned, twice.
+    for (i = 0; i < nr; i++) {
+        unsigned int j;
+
+        if (pids[i] <= 0)
+            return -EINVAL;
+        for (j = 0; j < i; j++)
+            if (pids[j] == pids[i])
+                return -EINVAL;
+    }
+
+    ns = nr ? get_pid_ns(task_active_pid_ns(current)) : NULL;
+    mutex_lock(&scan_mutex);
+    mutex_lock(&targets_lock);
+    memcpy(targets.pids, pids, nr * sizeof(*pids));
+    targets.nr_pids = nr;
+    old = targets.pids_ns;
+    targets.pids_ns = ns;
+    mutex_unlock(&targets_lock);
+    mutex_unlock(&scan_mutex);
+
+    if (old)
+        put_pid_ns(old);
+    return 0;
+}
+
+static int target_pids_get(char *buf, const struct kernel_param *kp)
+{
+    unsigned int i;
+    int len = 0;
+
+    mutex_lock(&targets_lock);
+    for (i = 0; i < targets.nr_pids; i++)
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%s%d", i ? "," : "",
+                         targets.pids[i]);
+    mutex_unlock(&targets_lock);
+    len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+    return len;
+}
+
+static const struct kernel_param_ops target_pids_ops = {
+    .set = target_pids_set,
+    .get = target_pids_get,
+};
+module_param_cb(target_pids, &target_pids_ops, NULL, 0644);
+MODULE_PARM_DESC(target_pids, "Comma-separated PIDs to report on instead of scanning every process");
+
+static int target_comm_set(const char *val, const struct kernel_param *kp)
+{
+    char comm[TASK_COMM_LEN];
+
+    // Trailing newline from "echo" is not part of the prefix.
+    strscpy(comm, val, sizeof(comm));
+    strim(comm);
+
+    mutex_lock(&scan_mutex);
+    mutex_lock(&targets_lock);
+    strscpy(targets.comm, comm, sizeof(targets.comm));
+    targets.comm_len = strlen(targets.comm);
+    mutex_unlock(&targets_lock);
+    mutex_unlock(&scan_mutex);
+    return 0;
+}
+
+static int target_comm_get(char *buf, const struct kernel_param *kp)
+{
+    int len;
+
+    mutex_lock(&targets_lock);
+    len = scnprintf(buf, PAGE_SIZE, "%s\n", targets.comm);
+    mutex_unlock(&targets_lock);
+    return len;
+}
+
+static const struct kernel_param_ops target_comm_ops = {
+    .set = target_comm_set,
+    .get = target_comm_get,
+};
+module_param_cb(target_comm, &target_comm_ops, NULL, 0644);
+MODULE_PARM_DESC(target_comm, "Only report processes whose name starts with this prefix");
+
+static int target_cgroup_set(const char *val, const struct kernel_param *kp)
+{
+#ifdef CONFIG_CGROUPS
+    struct cgroup *cgrp = NULL, *old;
+    char *path;
+
+    path = kstrdup(val, GFP_KERNEL);
+    if (!path)
+        return -ENOMEM;
+    strim(path);
+    if (strlen(path) >= sizeof(targets.cgrp_path)) {
+        kfree(path);
+        return -ENAMETOOLONG;
+    }
+
+    // Paths are relative to the cgroup v2 root, e.g. /system.slice/foo.service.
+    if (*path) {
+        cgrp = cgroup_get_from_path(path);
+        if (IS_ERR(cgrp)) {
+            kfree(path);
+            return PTR_ERR(cgrp);
+        }
+    }
+
+    mutex_lock(&scan_mutex);
+    mutex_lock(&targets_lock);
+    old = targets.cgrp;
+    targets.cgrp = cgrp;
+    strscpy(targets.cgrp_path, path, sizeof(targets.cgrp_path));
+    mutex_unlock(&targets_lock);
+    mutex_unlock(&scan_mutex);
+
+    if (old)
+        cgroup_put(old);
+    kfree(path);
+    return 0;
+#else
+    return -EOPNOTSUPP;
+#endif
+}
+
+static int target_cgroup_get(char *buf, const struct kernel_param *kp)
+{
+    int len;
+
+    mutex_lock(&targets_lock);
+    len = scnprintf(buf, PAGE_SIZE, "%s\n", targets.cgrp_path);
+    mutex_unlock(&targets_lock);
+    return len;
+}
+
+static const struct kernel_param_ops target_cgroup_ops = {
+    .set = target_cgroup_set,
+    .get = target_cgroup_get,
+};
+module_param_cb(target_cgroup, &target_cgroup_ops, NULL, 0644);
+MODULE_PARM_DESC(target_cgroup, "Only report processes inside this cgroup v2 path (empty = any)");
+
+static int target_pidns_set(const char *val, const struct kernel_param *kp)
+{
+    struct pid_namespace *ns = NULL, *old;
+    struct task_struct *task;
+    int pid, ret;
+
+    ret = kstrtoint(val, 10, &pid);
+    if (ret)
+        return ret;
+
+    // The namespace is the one the given process lives in; 0 clears it.
+    if (pid > 0) {
+        rcu_read_lock();
+        task = pid_task(find_vpid(pid), PIDTYPE_PID);
+        if (task)
+            ns = get_pid_ns(task_active_pid_ns(task));
+        rcu_read_unlock();
+        if (!ns)
+            return -ESRCH;
+    }
+
+    mutex_lock(&scan_mutex);
+    mutex_lock(&targets_lock);
+    old = targets.pidns;
+    targets.pidns = ns;
+    targets.pidns_pid = ns ? pid : 0;
+    mutex_unlock(&targets_lock);
+    mutex_unlock(&scan_mutex);
+
+    if (old)
+        put_pid_ns(old);
+    return 0;
+}
+
+static int target_pidns_get(char *buf, const struct kernel_param *kp)
+{
+    int len;
+
+    mutex_lock(&targets_lock);
+    len = scnprintf(buf, PAGE_SIZE, "%d\n", targets.pidns_pid);
+    mutex_unlock(&targets_lock);
+    return len;
+}
+
+static const struct kernel_param_ops target_pidns_ops = {
+    .set = target_pidns_set,
+    .get = target_pidns_get,
+};
+module_param_cb(target_pidns, &target_pidns_ops, NULL, 0644);
+MODULE_PARM_DESC(target_pidns,
+                 "Only report processes in the PID namespace of this PID (0 = any)");
+
+/**
+ * targets_release - Drop the cgroup and namespace references of the targets.
+ */
+static void targets_release(void)
+{
+#ifdef CONFIG_CGROUPS
+    if (targets.cgrp)
+        cgroup_put(targets.cgrp);
+    targets.cgrp = NULL;
+#endif
+    if (targets.pidns)
+        put_pid_ns(targets.pidns);
+    targets.pidns = NULL;
+    if (targets.pids_ns)
+        put_pid_ns(targets.pids_ns);
+    targets.pids_ns = NULL;
+}
+
+/**
+ * task_selected - Decide whether a process belongs in the report.
+ * @task: Candidate process; the caller holds rcu_read_lock() and either
+ *        scan_mutex or targets_lock.
+ * @listed: @task was named in target_pids, so min_pid does not apply.
+ */
+static bool task_selected(struct task_struct *task, bool listed)
+{
+    if (!listed && task->pid <= READ_ONCE(min_pid))
+        return false;
+    if (targets.comm_len && strncmp(task->comm, targets.comm, targets.comm_len))
+        return false;
+#ifdef CONFIG_CGROUPS
+    // css_task_iter_*() is not exported to modules, but testing the default
+    // hierarchy cgroup of each task is a few pointer loads next to a walk.
+    if (targets.cgrp && !cgroup_is_descendant(task_dfl_cgroup(task), targets.cgrp))
+        return false;
+#endif
+    if (targets.pidns && !task_pid_nr_ns(task, targets.pidns))
+        return false;
+    return true;
+}
+
+//----------------------------------
+//        PARALLEL SCANNING
+//----------------------------------
+
+#if defined(CONFIG_MMU_NOTIFIER) && LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+/**
+ * struct tracked_mm - Invalidation counter attached to one target mm.
+ * @mn:     Notifier, one per mm for this module (mmu_notifier_get()).
+ * @events: Invalidations of any part of the address space so far.
+ *
+ * Every unmap, migration, CoW break, THP split or collapse and protection
+ * change invalidates the old translation first, so a walk that saw @events
+ * at a value still current found every page where it still is. Faults
+ * that only add pages do not invalidate anything; they move the RSS
+ * counters of the fingerprint instead.
+ */
+struct tracked_mm {
+    struct mmu_notifier mn;
+    atomic_t events;
+};
+
+static int tracked_mm_invalidate(struct mmu_notifier *mn,
+                                 const struct mmu_notifier_range *range)
+{
+    atomic_inc(&container_of(mn, struct tracked_mm, mn)->events);
+    return 0;                   // Never blocks, so fine in every context
+}
+
+static struct mmu_notifier *tracked_mm_alloc(struct mm_struct *mm)
+{
+    struct tracked_mm *track = kzalloc(sizeof(*track), GFP_KERNEL);
+
+    return track ? &track->mn : ERR_PTR(-ENOMEM);
+}
+
+static void tracked_mm_free(struct mmu_notifier *mn)
+{
+    kfree(container_of(mn, struct tracked_mm, mn));
+}
+
+static const struct mmu_notifier_ops tracked_mm_ops = {
+    .invalidate_range_start = tracked_mm_invalidate,
+    .alloc_notifier         = tracked_mm_alloc,
+    .free_notifier          = tracked_mm_free,
+};
+
+/**
+ * tracked_mm_get - Start tracking invalidations of @mm.
+ * @mm: Memory map with users; its mmap_lock is taken for writing once.
+ *
+ * Returns the tracker with a reference, or NULL if it cannot be attached.
+ */
+static struct tracked_mm *tracked_mm_get(struct mm_struct *mm)
+{
+    struct mmu_notifier *mn = mmu_notifier_get(&tracked_mm_ops, mm);
+
+    return IS_ERR(mn) ? NULL : container_of(mn, struct tracked_mm, mn);
+}
+
+static void tracked_mm_put(struct tracked_mm *track)
+{
+    if (track)
+        mmu_notifier_put(&track->mn);
+}
+
+static unsigned int tracked_mm_events(struct tracked_mm *track)
+{
+    return track ? atomic_read(&track->events) : 0;
+}
+
+// Waits until every tracker put so far has been freed.
+static void tracked_mm_sync(void)
+{
+    mmu_notifier_synchronize();
+}
+#else
+struct tracked_mm;
+
+static struct tracked_mm *tracked_mm_get(struct mm_struct *mm) { return NULL; }
+static void tracked_mm_put(struct tracked_mm *track) { }
+static unsigned int tracked_mm_events(struct tracked_mm *track) { return 0; }
+static void tracked_mm_sync(void) { }
+#endif
+
+/**
+ * struct mm_fingerprint - Cheap summary of an address space's page tables.
+ * @rss:       Resident file/anon/swap/shmem counters of the mm.
+ * @pgtables:  Bytes of page tables allocated for the mm.
+ * @map_count: Number of VMAs.
+ * @total_vm:  Pages of virtual address space mapped.
+ * @events:    Invalidations seen by the mm's notifier (track_events), or 0.
+ * @sharing:   pss_accounting was set; results walked without it lack the
+ *             anon/file split and PSS, and must not be reused with it.
+ *
+ * Every fault, unmap, swap-out and page-table allocation moves at least one
+ * of these, so an unchanged fingerprint means the walk would very likely
+ * find the same pages. Moves that keep every counter the same (migration,
+ * compaction, THP collapse) still invalidate the old mapping, so with
+ * track_events they show up in @events. Without it, and for updates still
+ * sitting in per-CPU counter batches, the forced full rescan every
+ * incremental_full_every scans catches them.
+ */
+struct mm_fingerprint {
+    unsigned long rss[NR_MM_COUNTERS];
+    unsigned long pgtables;
+    int map_count;
+    unsigned long total_vm;
+    unsigned int events;
+    bool sharing;
+};
+
+/**
+ * struct scan_item - One process of a report snapshot.
+ * @task:   Referenced task (get_task_struct()), released by release_snapshot().
+ * @mm:     Pinned memory map of @task, or NULL for kernel threads.
+ * @counts: Result slot, filled in when the job's units are merged.
+ * @fp:     Fingerprint of @mm taken at planning time (incremental mode).
+ * @cached: @counts was reused from the previous scan; @mm was not walked.
+ * @owner:  Earlier item with the same @mm whose result this item shares
+ *          (vfork children, CLONE_VM helpers), or NULL.
+ * @mm_node: Link in scan_mm_owners while the job is being planned.
+ * @walk_ns: Time its units took to walk, summed up when they are merged.
+ * @nid:    NUMA node holding the page tables of @mm.
+ * @track:  Invalidation tracker of @mm, with track_events.
+ * @track_new: @track was registered for this scan and its reference is
+ *          still owned here, not by a cache entry.
+ */
+struct scan_item {
+    struct task_struct *task;
+    struct mm_struct *mm;
+    struct page_counts counts;
+    struct mm_fingerprint fp;
+    bool cached;
+    struct scan_item *owner;
+    struct hlist_node mm_node;
+    u64 walk_ns;
+    int nid;
+    struct tracked_mm *track;
+    bool track_new;
+};
+
+/**
+ * struct scan_unit - An address range of one process, scanned by one worker.
+ * @item:  Process the range belongs to.
+ * @start: Start of the range (PMD aligned when it comes from a split VMA).
+ * @end:   End of the range (exclusive).
+ * @ws:    Result slot; written only by the worker that claimed this unit.
+ * @walk_ns: Time the walk of this unit took.
+ *
+ * Small processes are a single unit covering the whole address space; VMAs
+ * of at least split_vma_mb are cut into split_chunk_mb pieces so a single
+ * giant process is shared between workers.
+ */
+struct scan_unit {
+    struct scan_item *item;
+    unsigned long start;
+    unsigned long end;
+    struct walk_state ws;
+    u64 walk_ns;
+};
+
+/**
+ * struct scan_node_queue - The units whose page tables live on one node.
+ * @first: Start of the node's slice of scan_job.order.
+ * @nr:    Units in the slice.
+ * @next:  Slot of the slice nobody has claimed yet.
+ */
+struct scan_node_queue {
+    unsigned int first;
+    unsigned int nr;
+    atomic_t next;
+};
+
+/**
+ * struct scan_job - A snapshot of processes shared by the scan workers.
+ * @items:    Snapshotted processes, in for_each_process() order.
+ * @nr_items: Number of valid entries in @items.
+ * @units:    Work units, grouped by item and sorted by address within one.
+ * @nr_units: Number of valid entries in @units.
+ * @max_units: Allocated size of @units.
+ * @nr_cached: Items whose result came from the incremental cache.
+ * @nr_shared: Items sharing the address space of an earlier item.
+ * @next:     Index of the next unit nobody has claimed yet.
+ * @queues:   Per-node slices of @order, or NULL to take units in order.
+ * @order:    Unit indices grouped by the node of their page tables.
+ * @pooled:   @items and @units live in the scan pool instead of being owned.
+ *
+ * Workers pull units with an atomic cursor, so a handful of huge processes
+ * do not leave the other workers idle the way static partitioning would.
+ * With @queues, each worker drains the units of its own node first and only
+ * then helps with the other nodes.
+ */
+struct scan_job {
+    struct scan_item *items;
+    unsigned int nr_items;
+    struct scan_unit *units;
+    unsigned int nr_units;
+    unsigned int max_units;
+    unsigned int nr_cached;
+    unsigned int nr_shared;
+    atomic_t next;
+    struct scan_node_queue *queues;
+    unsigned int *order;
+    bool pooled;
+};
+
+/**
+ * struct scan_worker - One member of the bounded worker pool.
+ * @work: Work item queued on scan_wq.
+ * @job:  Job this worker takes units from.
+ * @nid:  Node the worker runs on and takes units from first.
+ */
+struct scan_worker {
+    struct work_struct work;
+    struct scan_job *job;
+    int nid;
+};
+
+static struct workqueue_struct *scan_wq;    // Unbound queue running the workers
+
+/**
+ * phys_scan - Physical block map of the scan in progress.
+ * @blocks:    One entry per 2 MiB of physical memory, or NULL when off.
+ * @nr_blocks: Entries in @blocks.
+ * @items:     Items of the job, which block owners are indices into.
+ *
+ * Set up by phys_map_begin() and only used under scan_mutex.
+ */
+static struct {
+    struct phys_block *blocks;
+    unsigned long nr_blocks;
+    struct scan_item *items;
+} phys_scan;
+static struct scan_buf phys_buf;           // Memory of phys_scan.blocks
+
+/**
+ * snapshot_listed_tasks - Take a reference on every process in target_pids.
+ * @job: Job to fill, with room for targets.nr_pids items.
+ *
+ * Each PID is looked up directly, so a short list costs a few hash lookups
+ * instead of a pass over every process in the system.
+ */
+static void snapshot_listed_tasks(struct scan_job *job)
+{
+    struct task_struct *proc;
+    unsigned int i;
+
+    rcu_read_lock();
+    for (i = 0; i < targets.nr_pids; i++) {
+        proc = pid_task(find_pid_ns(targets.pids[i], targets.pids_ns), PIDTYPE_TGID);
+        if (!proc || !task_selected(proc, true))
+            continue;
+        get_task_struct(proc);
+        job->items[job->nr_items++].task = proc;
+    }
+    rcu_read_unlock();
+}
+
+/**
+ * snapshot_tasks - Take a reference on every process to be reported.
+ * @job: Job to fill; must be released with release_snapshot().
+ * @pooled: Take the arrays from the scan pool; the job must then be released
+ *          before scan_mutex is dropped.
+ *
+ * The process list is only stable under RCU, where we cannot sleep, so the
+ * processes are counted first, the array is allocated outside RCU, and the
+ * second pass stops early if processes were forked in between. The caller
+ * holds scan_mutex, which keeps the targets stable.
+ *
+ * Returns 0 on success or -ENOMEM.
+ */
+static int snapshot_tasks(struct scan_job *job, bool pooled)
+{
+    struct task_struct *proc;
+    unsigned int capacity = 0;
+    unsigned int i;
+
+    memset(job, 0, sizeof(*job));
+    job->pooled = pooled;
+
+    if (targets.nr_pids) {
+        capacity = targets.nr_pids;
+    } else {
+        rcu_read_lock();
+        for_each_process(proc)
+            capacity++;
+        rcu_read_unlock();
+
+        // Leave some headroom for processes created while we allocate.
+        capacity += 64;
+    }
+    if (pooled)
+        job->items = scan_buf_get(&items_buf, capacity * sizeof(*job->items), 0);
+    else
+        job->items = kvcalloc(capacity, sizeof(*job->items), GFP_KERNEL);
+    if (!job->items)
+        return -ENOMEM;
+
+    if (targets.nr_pids) {
+        snapshot_listed_tasks(job);
+        goto pin_mms;
+    }
+
+    rcu_read_lock();
+    for_each_process(proc) {
+        if (job->nr_items == capacity)
+            break;
+        if (!task_selected(proc, false))
+            continue;
+        get_task_struct(proc);
+        job->items[job->nr_items++].task = proc;
+    }
+    rcu_read_unlock();
+
+pin_mms:
+    // get_task_mm() may sleep, so the memory maps are pinned outside RCU.
+    for (i = 0; i < job->nr_items; i++)
+        job->items[i].mm = get_task_mm(job->items[i].task);
+
+    return 0;
+}
+
+/**
+ * release_snapshot - Drop the references taken by snapshot_tasks().
+ * @job: Job whose items and units are released.
+ */
+static void release_snapshot(struct scan_job *job)
+{
+    unsigned int i;
+
+    for (i = 0; i < job->nr_items; i++) {
+        if (job->items[i].track_new)
+            tracked_mm_put(job->items[i].track);    // Never made it into the cache
+        if (job->items[i].mm)
+            mmput(job->items[i].mm);
+        put_task_struct(job->items[i].task);
+    }
+    if (!job->pooled) {
+        kvfree(job->items);
+        kvfree(job->units);
+    }
+    memset(job, 0, sizeof(*job));
+}
+
+/**
+ * scan_job_add_unit - Append a work unit to @job, growing the array as needed.
+ *
+ * Returns 0 on success or -ENOMEM.
+ */
+static int scan_job_add_unit(struct scan_job *job, struct scan_item *item,
+                             unsigned long start, unsigned long end)
+{
+    struct scan_unit *unit;
+
+    if (job->nr_units == job->max_units) {
+        unsigned int new_max = max(2 * job->max_units, job->nr_items + 64);
+        struct scan_unit *units;
+
+        if (job->pooled) {
+            units = scan_buf_get(&units_buf, new_max * sizeof(*units),
+                                 job->nr_units * sizeof(*units));
+            if (!units)
+                return -ENOMEM;
+            new_max = units_buf.size / sizeof(*units);
+        } else {
+            units = kvcalloc(new_max, sizeof(*units), GFP_KERNEL);
+            if (!units)
+                return -ENOMEM;
+            if (job->units)
+                memcpy(units, job->units, job->nr_units * sizeof(*units));
+            kvfree(job->units);
+        }
+        job->units = units;
+        job->max_units = new_max;
+    }
+
+    unit = &job->units[job->nr_units++];
+    memset(unit, 0, sizeof(*unit));
+    unit->item = item;
+    unit->start = start;
+    unit->end = end;
+    return 0;
+}
+
+/**
+ * plan_item_units - Cut the address space of one process into work units.
+ * @job:  Job receiving the units.
+ * @item: Process to plan; its mm is pinned.
+ * @split: Split VMAs of at least split_vma_mb into chunks.
+ *
+ * Consecutive small VMAs share one unit that reaches up to the next large
+ * VMA; every large VMA becomes a series of PMD-aligned chunks. Together the
+ * units cover the whole address space in order, so merging them reproduces
+ * the serial walk exactly even if VMAs change after planning.
+ *
+ * Returns 0 on success or -ENOMEM.
+ */
+static int plan_item_units(struct scan_job *job, struct scan_item *item, bool split)
+{
+    struct mm_struct *mm = item->mm;
+    struct vm_area_struct *area;
+    VMA_CURSOR(vmi, mm, 0);
+    unsigned long threshold = (unsigned long)split_vma_mb << 20;
+    unsigned long chunk = max(ALIGN((unsigned long)split_chunk_mb << 20, PMD_SIZE),
+                              PMD_SIZE);
+    unsigned long cursor = 0;               // Start of the pending unit
+    int ret = 0;
+
+    if (!split || !threshold)
+        return scan_job_add_unit(job, item, 0, TASK_SIZE);
+
+    mmap_read_lock(mm);
+    for_each_vma_cursor(vmi, area, TASK_SIZE) {
+        unsigned long addr, chunk_end;
+
+        if (ret)
+            break;
+
+        if (area->vm_end - area->vm_start < threshold)
+            continue;
+
+        // Close the unit holding the small VMAs before this one. Chunk
+        // boundaries are multiples of @chunk and therefore PMD aligned.
+        addr = ALIGN_DOWN(area->vm_start, PMD_SIZE);
+        if (addr > cursor)
+            ret = scan_job_add_unit(job, item, cursor, addr);
+        cursor = max(cursor, addr);
+
+        while (!ret && cursor < area->vm_end) {
+            chunk_end = min(ALIGN_DOWN(cursor, chunk) + chunk, ALIGN(area->vm_end, PMD_SIZE));
+            ret = scan_job_add_unit(job, item, cursor, chunk_end);
+            cursor = chunk_end;
+        }
+    }
+    mmap_read_unlock(mm);
+
+    if (!ret && cursor < TASK_SIZE)
+        ret = scan_job_add_unit(job, item, cursor, TASK_SIZE);
+    return ret;
+}
+
+//----------------------------------
+//       INCREMENTAL RESCANS
+//----------------------------------
+
+/**
+ * struct mm_cache_entry - Result of the last walk of one address space.
+ * @node:      Link in mm_cache.
+ * @mm:        Address space, kept allocated with mmgrab() so the pointer
+ *             cannot be reused by another process while it is cached.
+ * @fp:        Fingerprint taken just before the cached walk.
+ * @counts:    Page counts that walk produced.
+ * @last_seq:  Last scan that saw this mm; older entries are evicted.
+ * @track:     Invalidation tracker of the mm, holding a reference, or NULL.
+ * @pid:       Process the mm was last walked for, for /proc/procReport_live.
+ * @comm:      Its name.
+ * @walked_ns: When that walk was planned.
+ */
+struct mm_cache_entry {
+    struct hlist_node node;
+    struct mm_struct *mm;
+    struct mm_fingerprint fp;
+    struct page_counts counts;
+    u64 last_seq;
+    struct tracked_mm *track;
+    pid_t pid;
+    char comm[TASK_COMM_LEN];
+    u64 walked_ns;
+};
+
+#define MM_CACHE_BITS 8
+static DEFINE_HASHTABLE(mm_cache, MM_CACHE_BITS);  // Protected by scan_mutex
+static struct kmem_cache *mm_cache_slab;           // Holds the mm_cache_entry objects
+static u64 mm_cache_seq;                           // Scans run with the cache
+static bool mm_cache_active;                       // incremental, read once per scan
+static unsigned int scans_since_full;              // For incremental_full_every
+
+static void mm_fingerprint_take(struct mm_struct *mm, struct mm_fingerprint *fp)
+{
+    int i;
+
+    memset(fp, 0, sizeof(*fp));
+    for (i = 0; i < NR_MM_COUNTERS; i++)
+        fp->rss[i] = get_mm_counter(mm, i);
+    fp->pgtables = mm_pgtables_bytes(mm);
+    fp->map_count = READ_ONCE(mm->map_count);
+    fp->total_vm = READ_ONCE(mm->total_vm);
+    fp->sharing = READ_ONCE(pss_accounting);
+}
+
+static struct mm_cache_entry *mm_cache_find(struct mm_struct *mm)
+{
+    struct mm_cache_entry *entry;
+
+    hash_for_each_possible(mm_cache, entry, node, (unsigned long)mm)
+        if (entry->mm == mm)
+            return entry;
+    return NULL;
+}
+
+/**
+ * mm_cache_flush - Drop every cached result.
+ */
+static void mm_cache_flush(void)
+{
+    struct mm_cache_entry *entry;
+    struct hlist_node *tmp;
+    int bkt;
+
+    hash_for_each_safe(mm_cache, bkt, tmp, entry, node) {
+        hash_del(&entry->node);
+        tracked_mm_put(entry->track);
+        mmdrop(entry->mm);
+        kmem_cache_free(mm_cache_slab, entry);
+    }
+}
+
+/**
+ * mm_cache_begin - Start a scan that may reuse cached results.
+ *
+ * Returns true if cached results may be used by this scan, false if it has
+ * to walk everything (incremental mode off, or a forced full rescan). The
+ * first scan after incremental was cleared drops the cache, so entries do
+ * not hold their mms and trackers, or come back stale when it is set again.
+ */
+static bool mm_cache_begin(void)
+{
+    unsigned int full_every = READ_ONCE(incremental_full_every);
+
+    mm_cache_seq++;
+    mm_cache_active = READ_ONCE(incremental);
+    if (!mm_cache_active) {
+        mm_cache_flush();
+        return false;
+    }
+    if (full_every && ++scans_since_full >= full_every) {
+        scans_since_full = 0;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * mm_cache_lookup - Reuse the cached counts of an unchanged process.
+ * @item:     Process about to be planned; its fingerprint is taken here.
+ * @use_hits: Cached results may be used (see mm_cache_begin()).
+ *
+ * Returns true if @item->counts was filled from the cache and the process
+ * does not need walking.
+ */
+static bool mm_cache_lookup(struct scan_item *item, bool use_hits)
+{
+    struct mm_cache_entry *entry;
+
+    if (!mm_cache_active)
+        return false;
+
+    mm_fingerprint_take(item->mm, &item->fp);
+    entry = mm_cache_find(item->mm);
+
+    // Attach a tracker the first time a target is seen. Until then its
+    // invalidations went unseen, so the first tracked scan always walks it.
+    item->track = entry ? entry->track : NULL;
+    if (!item->track && READ_ONCE(track_events) && targets.nr_pids) {
+        item->track = tracked_mm_get(item->mm);
+        item->track_new = item->track != NULL;
+    }
+    item->fp.events = tracked_mm_events(item->track);
+    if (item->track_new)
+        return false;
+
+    if (!entry || !use_hits || memcmp(&entry->fp, &item->fp, sizeof(item->fp)))
+        return false;
+
+    entry->last_seq = mm_cache_seq;
+    item->counts = entry->counts;
+    item->cached = true;
+    return true;
+}
+
+/**
+ * mm_cache_update - Remember the walked processes and evict vanished ones.
+ * @job: Job whose units have been merged.
+ */
+static void mm_cache_update(struct scan_job *job)
+{
+    struct mm_cache_entry *entry;
+    struct hlist_node *tmp;
+    unsigned int i;
+    int bkt;
+
+    if (!mm_cache_active)
+        return;
+
+    for (i = 0; i < job->nr_items; i++) {
+        struct scan_item *item = &job->items[i];
+
+        if (!item->mm || item->cached || item->owner)
+            continue;
+
+        entry = mm_cache_find(item->mm);
+        if (!entry) {
+            entry = kmem_cache_alloc(mm_cache_slab, GFP_KERNEL);
+            if (!entry)
+                continue;       // Simply walked again next time
+            atomic64_inc(&stats.allocs);
+            mmgrab(item->mm);
+            entry->mm = item->mm;
+            entry->track = NULL;
+            hash_add(mm_cache, &entry->node, (unsigned long)item->mm);
+        }
+        if (item->track_new) {
+            entry->track = item->track;     // The entry takes over the reference
+            item->track_new = false;
+        }
+        entry->fp = item->fp;
+        entry->counts = item->counts;
+        entry->last_seq = mm_cache_seq;
+        entry->pid = item->task->pid;
+        get_task_comm(entry->comm, item->task);
+        entry->walked_ns = ktime_get_ns();
+    }
+
+    hash_for_each_safe(mm_cache, bkt, tmp, entry, node) {
+        if (entry->last_seq != mm_cache_seq) {
+            hash_del(&entry->node);
+            tracked_mm_put(entry->track);
+            mmdrop(entry->mm);
+            kmem_cache_free(mm_cache_slab, entry);
+        }
+    }
+}
+
+/**
+ * live_show - /proc/procReport_live: tracked processes without walking them.
+ *
+ * Lists the cached result of every mm that has an invalidation tracker,
+ * with its current resident pages and whether it changed since that walk
+ * (stale: RSS counters moved or a range was invalidated). Each line costs
+ * a fingerprint, not a walk; stale processes are walked again by the next
+ * scan, e.g. the one sample_interval_ms triggers.
+ */
+static int live_show(struct seq_file *m, void *v)
+{
+    struct mm_cache_entry *entry;
+    struct mm_fingerprint fp;
+    u64 now = ktime_get_ns();
+    int bkt;
+
+    if (mutex_lock_interruptible(&scan_mutex))
+        return -EINTR;
+    seq_puts(m, "proc_id,proc_name,contig_pages,noncontig_pages,total_pages,rss_pages,"
+                "invalidations,stale,age_ms\n");
+    hash_for_each(mm_cache, bkt, entry, node) {
+        if (!entry->track)
+            continue;
+        mm_fingerprint_take(entry->mm, &fp);
+        fp.events = tracked_mm_events(entry->track);
+        seq_printf(m, "%d,%s,%lu,%lu,%lu,%lu,%u,%d,%llu\n", entry->pid, entry->comm,
+                   entry->counts.contig, entry->counts.noncontig, entry->counts.total,
+                   get_mm_rss(entry->mm), fp.events - entry->fp.events,
+                   memcmp(&fp, &entry->fp, sizeof(fp)) != 0,
+                   div_u64(now - entry->walked_ns, NSEC_PER_MSEC));
+    }
+    mutex_unlock(&scan_mutex);
+    return 0;
+}
+
+#define SCAN_MM_OWNER_BITS 10
+static DEFINE_HASHTABLE(scan_mm_owners, SCAN_MM_OWNER_BITS); // Under scan_mutex
+
+/**
+ * find_mm_owner - Find an earlier item of the job walking the same mm.
+ * @item: Item being planned.
+ *
+ * Every item holds a reference on its mm for the whole scan, so two items
+ * with the same mm pointer really do share one address space; the pointer
+ * cannot have been freed and reused in between.
+ *
+ * Returns the owning item, or NULL after registering @item as the owner.
+ */
+static struct scan_item *find_mm_owner(struct scan_item *item)
+{
+    struct scan_item *owner;
+
+    hash_for_each_possible(scan_mm_owners, owner, mm_node, (unsigned long)item->mm)
+        if (owner->mm == item->mm)
+            return owner;
+
+    hash_add(scan_mm_owners, &item->mm_node, (unsigned long)item->mm);
+    return NULL;
+}
+
+/**
+ * mm_pgtable_node - NUMA node holding the top-level page table of @mm.
+ *
+ * The lower levels are allocated by the CPUs that faulted first, normally on
+ * the same node as the PGD, so that is where a walk of @mm reads from.
+ */
+static int mm_pgtable_node(struct mm_struct *mm)
+{
+    return page_to_nid(virt_to_page(mm->pgd));
+}
+
+/**
+ * plan_units - Build the work units of every snapshotted process.
+ * @job:   Job to plan.
+ * @split: Allow large VMAs to be split between workers.
+ *
+ * Each distinct address space is walked once per report: processes sharing
+ * an mm with an earlier one, and processes whose cached result is still
+ * valid, get no units at all.
+ *
+ * Returns 0 on success or -ENOMEM.
+ */
+static int plan_units(struct scan_job *job, bool split)
+{
+    // Cached processes would be missing from the physical map.
+    bool use_cache = mm_cache_begin() && !phys_scan.blocks;
+    unsigned int i;
+    int ret = 0;
+
+    for (i = 0; i < job->nr_items; i++) {
+        if (!job->items[i].mm)
+            continue;           // Kernel thread or exiting task: nothing to walk
+        job->items[i].owner = find_mm_owner(&job->items[i]);
+        if (job->items[i].owner) {
+            job->nr_shared++;
+            continue;
+        }
+        if (mm_cache_lookup(&job->items[i], use_cache)) {
+            job->nr_cached++;
+            continue;
+        }
+        job->items[i].nid = mm_pgtable_node(job->items[i].mm);
+        ret = plan_item_units(job, &job->items[i], split);
+        if (ret)
+            break;
+    }
+
+    // The items are freed with the job, so forget them again.
+    hash_init(scan_mm_owners);
+    atomic_set(&job->next, 0);
+    return ret;
+}
+
+/**
+ * scan_unit_walk - Walk the address range of one work unit.
+ * @unit: Unit to walk; the result is left in @unit->ws.
+ */
+static void scan_unit_walk(struct scan_unit *unit)
+{
+    u64 start = ktime_get_ns();
+
+    if (phys_scan.blocks) {
+        unit->ws.phys_blocks = phys_scan.blocks;
+        unit->ws.phys_nr = phys_scan.nr_blocks;
+        unit->ws.phys_owner = unit->item - phys_scan.items;
+    }
+
+    walk_mm_range_batched(&unit->ws, unit->item->mm, unit->start, unit->end);
+    unit->walk_ns = ktime_get_ns() - start;
+    atomic_inc(&stats.units_done);
+}
+
+/**
+ * scan_job_run_units - Claim and walk units until the job is exhausted.
+ * @job: Job to take units from.
+ * @nid: Node whose queue is drained first, when the job has node queues.
+ */
+static void scan_job_run_units(struct scan_job *job, int nid)
+{
+    unsigned int i, k;
+
+    if (!job->queues) {
+        while ((i = atomic_inc_return(&job->next) - 1) < job->nr_units)
+            scan_unit_walk(&job->units[i]);
+        return;
+    }
+
+    // Own node first, then help the others so nobody idles while work is left.
+    for (k = 0; k < nr_node_ids; k++) {
+        struct scan_node_queue *q = &job->queues[(nid + k) % nr_node_ids];
+
+        while ((i = atomic_inc_return(&q->next) - 1) < q->nr)
+            scan_unit_walk(&job->units[job->order[q->first + i]]);
+    }
+}
+
+/**
+ * scan_job_plan_nodes - Group the units of @job by the node of their tables.
+ * @job: Planned job.
+ *
+ * Leaves @job->queues NULL when NUMA placement is off, not worth it (all
+ * page tables on one node), or there is no memory for the index; the units
+ * are then taken in order as before. The index lives in the scan pool.
+ */
+static void scan_job_plan_nodes(struct scan_job *job)
+{
+    unsigned int i, nid, first = 0, nr_nodes = 0;
+
+    if (!READ_ONCE(numa_workers) || num_online_nodes() < 2 || !job->nr_units)
+        return;
+
+    job->queues = scan_buf_get(&queues_buf, nr_node_ids * sizeof(*job->queues), 0);
+    job->order = scan_buf_get(&order_buf, job->nr_units * sizeof(*job->order), 0);
+    if (!job->queues || !job->order)
+        goto none;
+
+    // Counting sort: size each node's slice, then fill the slices in order.
+    for (i = 0; i < job->nr_units; i++)
+        job->queues[job->units[i].item->nid].nr++;
+    for (nid = 0; nid < nr_node_ids; nid++) {
+        job->queues[nid].first = first;
+        first += job->queues[nid].nr;
+        nr_nodes += job->queues[nid].nr != 0;
+        job->queues[nid].nr = 0;
+    }
+    if (nr_nodes < 2)
+        goto none;
+    for (i = 0; i < job->nr_units; i++) {
+        struct scan_node_queue *q = &job->queues[job->units[i].item->nid];
+
+        job->order[q->first + q->nr++] = i;
+    }
+    return;
+
+none:
+    job->queues = NULL;
+    job->order = NULL;
+}
+
+/**
+ * scan_worker_node - Node the @i-th worker is started on.
+ * @job: Job with node queues.
+ * @i:   Worker index.
+ *
+ * Workers go round-robin over the nodes that have units, so every such node
+ * gets a local worker before any node gets a second one.
+ */
+static int scan_worker_node(struct scan_job *job, unsigned int i)
+{
+    unsigned int nid;
+
+    for (;;) {
+        for (nid = 0; nid < nr_node_ids; nid++) {
+            if (job->queues[nid].nr && i-- == 0)
+                return nid;
+        }
+    }
+}
+
+/**
+ * scan_item_done - Finish the counts of a walked process and account it.
+ * @item: Process whose units have all been merged.
+ * @mg:   Merge state of those units.
+ */
+static void scan_item_done(struct scan_item *item, struct walk_merge *mg)
+{
+    finish_counts(&item->counts, mg);
+
+    stats.walked++;
+    stats.walk_ns += item->walk_ns;
+    stats.walk_max_ns = max(stats.walk_max_ns, item->walk_ns);
+    trace_procreport_process(item->task, item->counts.total, item->walk_ns);
+}
+
+/**
+ * scan_job_merge - Stitch the unit results back into per-process counts.
+ * @job: Job whose units have all been walked.
+ */
+static void scan_job_merge(struct scan_job *job)
+{
+    struct scan_item *item = NULL;          // Process currently being merged
+    struct walk_merge mg = { 0 };           // Where its merged ranges ended
+    unsigned int i;
+
+    for (i = 0; i < job->nr_units; i++) {
+        struct scan_unit *unit = &job->units[i];
+
+        if (unit->item != item) {
+            if (item)
+                scan_item_done(item, &mg);
+            item = unit->item;
+        }
+        merge_walk_state(&item->counts, &mg, &unit->ws);
+        item->walk_ns += unit->walk_ns;
+    }
+    if (item)
+        scan_item_done(item, &mg);
+
+    // Attach the result of each walked mm to every task sharing it.
+    for (i = 0; i < job->nr_items; i++)
+        if (job->items[i].owner)
+            job->items[i].counts = job->items[i].owner->counts;
+}
+
+/**
+ * scan_worker_fn - Workqueue entry point of a scan worker.
+ */
+static void scan_worker_fn(struct work_struct *work)
+{
+    struct scan_worker *worker = container_of(work, struct scan_worker, work);
+
+    scan_job_run_units(worker->job, worker->nid);
+}
+
+/**
+ * scan_job_run - Scan every process of @job, in parallel when possible.
+ * @job: Snapshot to scan.
+ *
+ * The caller holds scan_mutex, which also protects the incremental cache
+ * and the scan pool.
+ *
+ * A throttled scan (scan_cpu_permille) runs on a single worker, so the budget
+ * is one of one CPU however many workers are configured, and it still runs
+ * on scan_wq whose nice level and cpumask can be set in
+ * /sys/bus/workqueue/devices/procReport.
+ *
+ * Returns the number of workers that took part in the scan, or a negative
+ * error code if the job could not be planned.
+ */
+static int scan_job_run(struct scan_job *job)
+{
+    struct scan_worker *workers;
+    bool throttled = READ_ONCE(scan_cpu_permille);
+    unsigned int nr_workers = throttled ? 1 : scan_workers ? scan_workers : num_online_cpus();
+    unsigned int i;
+    u64 phase_ns = ktime_get_ns();          // Start of the current phase
+    u64 walk_ns;
+    s64 ptes;
+    int ret;
+
+    // Splitting VMAs only pays off when somebody else can take the pieces.
+    ret = plan_units(job, nr_workers > 1 && scan_wq);
+    if (ret)
+        return ret;
+    walk_ns = ktime_get_ns();
+    stats.last_plan_ns = walk_ns - phase_ns;
+    ptes = atomic64_read(&stats.ptes);
+    WRITE_ONCE(stats.scan_units, job->nr_units);
+    atomic_set(&stats.units_done, 0);
+
+    nr_workers = min(nr_workers, job->nr_units);
+    workers = (nr_workers > 1 || throttled) && nr_workers && scan_wq ?
+              scan_buf_get(&workers_buf, nr_workers * sizeof(*workers), 0) : NULL;
+    if (!workers) {
+        // Serial mode, or no memory for the pool: scan in the caller.
+        scan_job_run_units(job, NUMA_NO_NODE);
+        nr_workers = 1;
+    } else {
+        scan_job_plan_nodes(job);
+        for (i = 0; i < nr_workers; i++) {
+            workers[i].job = job;
+            INIT_WORK(&workers[i].work, scan_worker_fn);
+            if (job->queues) {
+                workers[i].nid = scan_worker_node(job, i);
+                queue_work_node(workers[i].nid, scan_wq, &workers[i].work);
+            } else {
+                queue_work(scan_wq, &workers[i].work);
+            }
+        }
+        for (i = 0; i < nr_workers; i++)
+            flush_work(&workers[i].work);
+        job->queues = NULL;
+        job->order = NULL;
+    }
+    phase_ns = ktime_get_ns();
+    stats.last_walk_ns = phase_ns - walk_ns;
+    stats.last_ptes = atomic64_read(&stats.ptes) - ptes;
+
+    scan_job_merge(job);
+    mm_cache_update(job);
+    stats.last_merge_ns = ktime_get_ns() - phase_ns;
+    return nr_workers;
+}
+
+//----------------------------------
+//    PHYSICAL FRAGMENTATION MAP
+//----------------------------------
+
+// phys_summary row sizes (index into its rows).
+enum { PHYS_2M, PHYS_1G, PHYS_NR_SIZES };
+
+/**
+ * struct phys_row - Huge-page blocks of one size, by how full they are.
+ * @name:     Block size as shown in /proc/procReport_physmap.
+ * @blocks:   Blocks of this size below the highest node end.
+ * @unmapped: Blocks no scanned process maps a page of.
+ * @sparse:   Blocks with at most phys_sparse_pages mapped pages per 2 MiB;
+ *            nearly free, but they cannot become a huge page until the few
+ *            pages are migrated away.
+ * @partial:  Other blocks that are not full.
+ * @full:     Blocks with every page mapped.
+ */
+struct phys_row {
+    const char *name;
+    unsigned long blocks;
+    unsigned long unmapped;
+    unsigned long sparse;
+    unsigned long partial;
+    unsigned long full;
+};
+
+/**
+ * struct phys_summary - What the physical map says about huge-page blocks.
+ * @valid: The scan built a map.
+ * @rows:  One row per block size, indexed by PHYS_2M and PHYS_1G.
+ *
+ * Only mappings of the scanned processes are seen: page cache, slab and
+ * other kernel memory count as unmapped, so unmapped is not the same as free.
+ */
+struct phys_summary {
+    bool valid;
+    struct phys_row rows[PHYS_NR_SIZES];
+};
+
+/**
+ * phys_map_begin - Set up an empty physical map for the scan of @job.
+ *
+ * The map covers PFNs up to the end of the highest online node, at 8 bytes
+ * per 2 MiB (4 MiB for 1 TiB of memory), and lives in the scan pool.
+ */
+static void phys_map_begin(struct scan_job *job)
+{
+    unsigned long max_pfn = 0;
+    int nid;
+
+    phys_scan.blocks = NULL;
+    if (!READ_ONCE(phys_map))
+        return;
+
+    for_each_online_node(nid)
+        max_pfn = max(max_pfn, node_end_pfn(nid));
+    phys_scan.nr_blocks = DIV_ROUND_UP(max_pfn, PHYS_BLOCK_PAGES);
+    phys_scan.blocks = scan_buf_get(&phys_buf,
+                                    phys_scan.nr_blocks * sizeof(*phys_scan.blocks), 0);
+    phys_scan.items = job->items;
+}
+
+// Account one block of @row's size with @pages mapped out of @max.
+static void phys_row_add(struct phys_row *row, unsigned long pages, unsigned long max)
+{
+    row->blocks++;
+    if (!pages)
+        row->unmapped++;
+    else if (pages >= max)
+        row->full++;
+    else if (pages <= READ_ONCE(phys_sparse_pages) * (max / PHYS_BLOCK_PAGES))
+        row->sparse++;
+    else
+        row->partial++;
+}
+
+/**
+ * phys_map_finish - Summarize the map and charge sparse blocks to processes.
+ * @job: Scanned job; items owning sparse blocks get them in their counts.
+ * @sum: Filled with the block summary.
+ *
+ * A block mapped by several processes is charged to the last one that
+ * marked it. Mapping counts are capped at the block size, so pages shared
+ * between processes cannot make a block look fuller than it is by much.
+ * Only owners of an mm walk it, so the charges are copied to the tasks
+ * sharing it here, as scan_job_merge() did with the other counts.
+ */
+static void phys_map_finish(struct scan_job *job, struct phys_summary *sum)
+{
+    unsigned long per_gb = PUD_SIZE / PMD_SIZE;
+    unsigned long b, gb_pages = 0;
+
+    memset(sum, 0, sizeof(*sum));
+    sum->rows[PHYS_2M].name = "2M";
+    sum->rows[PHYS_1G].name = "1G";
+    if (!phys_scan.blocks)
+        return;
+    sum->valid = true;
+
+    for (b = 0; b < phys_scan.nr_blocks; b++) {
+        unsigned long pages = min_t(unsigned long, atomic_read(&phys_scan.blocks[b].refs),
+                                    PHYS_BLOCK_PAGES);
+
+        phys_row_add(&sum->rows[PHYS_2M], pages, PHYS_BLOCK_PAGES);
+        if (pages && pages <= READ_ONCE(phys_sparse_pages)) {
+            struct scan_item *item = &job->items[phys_scan.blocks[b].owner];
+
+            item->counts.sparse_blocks++;
+            item->counts.sparse_pages += pages;
+        }
+
+        gb_pages += pages;
+        if ((b + 1) % per_gb == 0 || b + 1 == phys_scan.nr_blocks) {
+            phys_row_add(&sum->rows[PHYS_1G], gb_pages, per_gb * PHYS_BLOCK_PAGES);
+            gb_pages = 0;
+        }
+    }
+    phys_scan.blocks = NULL;
+
+    for (b = 0; b < job->nr_items; b++) {
+        struct scan_item *item = &job->items[b];
+
+        if (item->owner) {
+            item->counts.sparse_blocks = item->owner->counts.sparse_blocks;
+            item->counts.sparse_pages = item->owner->counts.sparse_pages;
+        }
+    }
+}
+
+//----------------------------------
+//        REPORT SNAPSHOTS
+//----------------------------------
+
+/**
+ * struct report_row - One process line of a report.
+ * @pid:        Process ID.
+ * @comm:       Process name at the time of the scan.
+ * @start_time: Boot-based start time of the process, telling a reused PID
+ *              from the process that had it before.
+ * @counts:     Page counts of the process.
+ */
+struct report_row {
+    pid_t pid;
+    char comm[TASK_COMM_LEN];
+    u64 start_time;
+    struct page_counts counts;
+};
+
+/**
+ * struct report_snapshot - A finished, self-contained report.
+ * @ref:          One reference per reader plus one while it is the latest.
+ * @rcu:          Frees the snapshot once no reader can still be looking it up.
+ * @seq:          Scan sequence number, increasing by one per scan.
+ * @timestamp_ns: CLOCK_REALTIME time the scan finished.
+ * @scan_us:      Wall-clock time the scan took.
+ * @nr_workers:   Workers that took part in the scan.
+ * @phys:         Physical block summary, valid with phys_map.
+ * @totals:       Sum of the counts of every row.
+ * @nr_rows:      Number of entries in @rows.
+ * @max_rows:     Room for rows, so a recycled snapshot can be reused.
+ * @rows:         One row per process, in for_each_process() order.
+ *
+ * Rows are copied out of the scan job, so a snapshot holds no task or mm
+ * references and can outlive the processes it describes. Snapshots are
+ * never modified after generate_report() returns.
+ */
+struct report_snapshot {
+    refcount_t ref;
+    struct rcu_head rcu;
+    u64 seq;
+    u64 timestamp_ns;
+    s64 scan_us;
+    int nr_workers;
+    struct phys_summary phys;
+    struct page_counts totals;
+    unsigned int nr_rows;
+    unsigned int max_rows;
+    struct report_row rows[];
+};
+
+static u64 scan_seq;                 // Last scan number handed out, under scan_mutex
+static struct report_snapshot __rcu *latest_snapshot;  // Last published report
+static struct report_snapshot *spare_snapshot;         // Last freed, for reuse (xchg())
+
+/**
+ * snapshot_alloc - Get an empty snapshot with room for @nr_rows rows.
+ *
+ * In periodic mode the snapshot replaced by a scan is freed a grace period
+ * later and waits in spare_snapshot, so the following scan reuses it
+ * instead of allocating one the size of the whole process table.
+ */
+static struct report_snapshot *snapshot_alloc(unsigned int nr_rows)
+{
+    struct report_snapshot *snap = xchg(&spare_snapshot, NULL);
+    unsigned int max_rows;
+
+    if (snap && snap->max_rows >= nr_rows) {
+        max_rows = snap->max_rows;
+        memset(snap, 0, sizeof(*snap));     // Rows are written before use
+        snap->max_rows = max_rows;
+        atomic64_inc(&stats.pool_reuses);
+        return snap;
+    }
+    kvfree(snap);
+
+    // Headroom like snapshot_tasks(), so a few new processes still fit.
+    max_rows = nr_rows + 64;
+    snap = kvzalloc(struct_size(snap, rows, max_rows), GFP_KERNEL);
+    if (snap) {
+        snap->max_rows = max_rows;
+        atomic64_inc(&stats.allocs);
+    }
+    return snap;
+}
+
+/**
+ * generate_report - Scan the selected processes into a new snapshot.
+ *
+ * Snapshots the processes chosen by the scan targets and computes their page
+ * counts on the worker pool. The rows keep the original process order. The caller
+ * holds scan_mutex.
+ *
+ * Returns the snapshot with one reference held, or an ERR_PTR() on failure.
+ */
+static struct report_snapshot *generate_report(void)
+{
+    struct report_snapshot *snap;
+    struct scan_job job;            // Processes being scanned
+    struct phys_summary phys;
+    int nr_workers;
+    unsigned int nr_cached, nr_shared;
+    bool unique;
+    unsigned int i;
+    ktime_t start;
+
+    start = ktime_get();
+    if (snapshot_tasks(&job, true))
+        return ERR_PTR(-ENOMEM);
+    stats.last_snapshot_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    phys_map_begin(&job);
+    nr_workers = scan_job_run(&job);
+    phys_map_finish(&job, &phys);
+    if (nr_workers < 0) {
+        release_snapshot(&job);
+        return ERR_PTR(nr_workers);
+    }
+
+    snap = snapshot_alloc(job.nr_items);
+    if (!snap) {
+        release_snapshot(&job);
+        return ERR_PTR(-ENOMEM);
+    }
+
+    // Copy the per-item result slots out and accumulate the grand totals.
+    unique = READ_ONCE(unique_mm_only);
+    for (i = 0; i < job.nr_items; i++) {
+        struct report_row *row = &snap->rows[snap->nr_rows];
+
+        if (unique && job.items[i].owner)
+            continue;           // Same address space as an earlier row
+        snap->nr_rows++;
+
+        row->pid = job.items[i].task->pid;
+        row->start_time = job.items[i].task->start_time;
+        get_task_comm(row->comm, job.items[i].task);
+        row->counts = job.items[i].counts;
+
+        page_counts_add(&snap->totals, &row->counts);
+    }
+    nr_cached = job.nr_cached;
+    nr_shared = job.nr_shared;
+    release_snapshot(&job);
+
+    refcount_set(&snap->ref, 1);
+    snap->phys = phys;
+    snap->seq = ++scan_seq;
+    snap->timestamp_ns = ktime_get_real_ns();
+    snap->scan_us = ktime_us_delta(ktime_get(), start);
+    snap->nr_workers = nr_workers;
+    stats.scans++;
+    stats.last_scan_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    stats.scan_ns += stats.last_scan_ns;
+    trace_procreport_scan(snap->seq, snap->nr_rows, nr_workers, snap->scan_us);
+    pr_debug("helloModule: Scanned %u processes (%u cached, %u shared mm) in %lld us with %d worker(s)\n",
+             snap->nr_rows, nr_cached, nr_shared, snap->scan_us, snap->nr_workers);
+    return snap;
+}
+
+static void snapshot_free_rcu(struct rcu_head *rcu)
+{
+    // Keep the snapshot for the next scan, evicting the one kept before it.
+    kvfree(xchg(&spare_snapshot, container_of(rcu, struct report_snapshot, rcu)));
+}
+
+/**
+ * snapshot_put - Drop a reference on a snapshot.
+ * @snap: Snapshot, or NULL.
+ *
+ * The memory is only returned after an RCU grace period, because
+ * snapshot_get_latest() may still be trying to take a reference on it.
+ */
+static void snapshot_put(struct report_snapshot *snap)
+{
+    if (snap && refcount_dec_and_test(&snap->ref))
+        call_rcu(&snap->rcu, snapshot_free_rcu);
+}
+
+/**
+ * snapshot_get_latest - Take a reference on the last published snapshot.
+ *
+ * Never blocks, even while a scan is in progress.
+ *
+ * Returns the snapshot, or NULL if nothing has been published yet.
+ */
+static struct report_snapshot *snapshot_get_latest(void)
+{
+    struct report_snapshot *snap;
+
+    rcu_read_lock();
+    snap = rcu_dereference(latest_snapshot);
+    if (snap && !refcount_inc_not_zero(&snap->ref))
+        snap = NULL;
+    rcu_read_unlock();
+    return snap;
+}
+
+//----------------------------------
+//       BINARY RING BUFFER
+//----------------------------------
+
+/**
+ * struct report_ring - mmap()-able ring of binary report records.
+ * @hdr:     Start of the vmalloc_user() area; the header lives here.
+ * @records: First record slot, right after the header page.
+ * @size:    Size of the whole area in bytes.
+ * @mask:    nr_records - 1.
+ *
+ * See procReport_abi.h for the layout and the lock-free reading protocol.
+ * The ring only ever has one writer, because records are only pushed while
+ * publishing a snapshot under scan_mutex.
+ */
+struct report_ring {
+    struct procreport_ring_header *hdr;
+    struct procreport_record *records;
+    size_t size;
+    u64 mask;
+};
+
+static struct report_ring ring;      // Only allocated when ring_records > 0
+
+/**
+ * ring_init - Allocate the ring buffer.
+ * @nr_records: Requested slot count, rounded up to a power of two.
+ *
+ * Returns 0 on success or -ENOMEM.
+ */
+static int ring_init(unsigned int nr_records)
+{
+    nr_records = roundup_pow_of_two(nr_records);
+    ring.size = PAGE_ALIGN(PAGE_SIZE + (size_t)nr_records * sizeof(*ring.records));
+
+    // vmalloc_user() memory is zeroed and may be remapped to userspace.
+    ring.hdr = vmalloc_user(ring.size);
+    if (!ring.hdr)
+        return -ENOMEM;
+
+    ring.records = (struct procreport_record *)((char *)ring.hdr + PAGE_SIZE);
+    ring.mask = nr_records - 1;
+
+    ring.hdr->magic = PROCREPORT_RING_MAGIC;
+    ring.hdr->version = PROCREPORT_RING_VERSION;
+    ring.hdr->header_size = PAGE_SIZE;
+    ring.hdr->record_size = sizeof(*ring.records);
+    ring.hdr->nr_records = nr_records;
+    return 0;
+}
+
+static void ring_exit(void)
+{
+    vfree(ring.hdr);
+    ring.hdr = NULL;
+}
+
+/**
+ * fill_record - Write @counts and the process identity into a binary record.
+ * @rec:          Record to fill; every field is written.
+ * @counts:       Counts of the process, or the totals.
+ * @pid:          Process ID, -1 for totals.
+ * @comm:         Process name, or NULL for totals.
+ * @flags:        PROCREPORT_REC_* flags.
+ * @timestamp_ns: CLOCK_REALTIME end of the scan.
+ * @seq:          Scan sequence number.
+ */
+static void fill_record(struct procreport_record *rec, const struct page_counts *counts,
+                        pid_t pid, const char *comm, u32 flags, u64 timestamp_ns, u64 seq)
+{
+    unsigned int i;
+
+    rec->pid = pid;
+    rec->flags = flags;
+    memset(rec->comm, 0, sizeof(rec->comm));
+    if (comm)
+        strscpy(rec->comm, comm, sizeof(rec->comm));
+    rec->contig = counts->contig;
+    rec->noncontig = counts->noncontig;
+    rec->total = counts->total;
+    rec->huge = counts->huge;
+    rec->timestamp_ns = timestamp_ns;
+    rec->scan_seq = seq;
+    rec->pmd_aligned = counts->pmd_aligned;
+    for (i = 0; i < PROCREPORT_RUN_BUCKETS; i++)
+        rec->runs[i] = counts->runs[i];
+    rec->swap = counts->swap;
+    rec->anon = counts->anon;
+    rec->file = counts->file;
+    rec->pss_kb = (counts->pss * (PAGE_SIZE >> 10)) >> PSS_SHIFT;
+    for (i = 0; i < PROCREPORT_MAX_NODES; i++)
+        rec->nodes[i] = counts->nodes[i];
+}
+
+/**
+ * ring_push - Write one record at the head of the ring and publish it.
+ *
+ * The record is filled before head moves past it (release store), which is
+ * what lets readers detect records overwritten during their copy.
+ */
+static void ring_push(const struct page_counts *counts, pid_t pid, const char *comm,
+                      u32 flags, const struct report_snapshot *snap)
+{
+    u64 head = ring.hdr->head;
+
+    fill_record(&ring.records[head & ring.mask], counts, pid, comm, flags,
+                snap->timestamp_ns, snap->seq);
+    smp_store_release(&ring.hdr->head, head + 1);
+}
+
+/**
+ * ring_publish_snapshot - Append every row of @snap and its totals to the ring.
+ * @snap: Snapshot being published; the caller holds scan_mutex.
+ */
+static void ring_publish_snapshot(const struct report_snapshot *snap)
+{
+    unsigned int i;
+
+    if (!ring.hdr)
+        return;
+
+    for (i = 0; i < snap->nr_rows; i++) {
+        const struct report_row *row = &snap->rows[i];
+
+        ring_push(&row->counts, row->pid, row->comm, 0, snap);
+    }
+    ring_push(&snap->totals, -1, NULL, PROCREPORT_REC_TOTALS, snap);
+    smp_store_release(&ring.hdr->scan_seq, snap->seq);
+}
+
+//----------------------------------
+//        PERIODIC SAMPLING
+//----------------------------------
+
+/**
+ * scan_and_publish - Run a scan and make it the latest snapshot.
+ *
+ * The new snapshot replaces the old one with an RCU pointer swap, so readers
+ * of the previous snapshot are never disturbed, and is appended to the
+ * binary ring.
+ *
+ * Returns the new snapshot with a reference for the caller, or an ERR_PTR().
+ */
+static struct report_snapshot *scan_and_publish(void)
+{
+    struct report_snapshot *snap, *old;
+
+    mutex_lock(&scan_mutex);
+    WRITE_ONCE(stats.scan_start_ns, ktime_get_ns());
+    snap = generate_report();
+    WRITE_ONCE(stats.scan_start_ns, 0);
+    if (!IS_ERR(snap)) {
+        ring_publish_snapshot(snap);
+        refcount_inc(&snap->ref);       // Reference owned by latest_snapshot
+        old = rcu_dereference_protected(latest_snapshot,
+                                        lockdep_is_held(&scan_mutex));
+        rcu_assign_pointer(latest_snapshot, snap);
+        snapshot_put(old);
+    }
+    mutex_unlock(&scan_mutex);
+    return snap;
+}
+
+static unsigned int sample_interval_ms;    // 0 = scan on demand only
+static bool sampler_ready;                 // sample_work may be queued, under sampler_lock
+static DEFINE_MUTEX(sampler_lock);         // Orders parameter writes against unload
+static void sample_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(sample_work, sample_work_fn);
+
+/**
+ * sample_work_fn - Background scan, re-armed every sample_interval_ms.
+ */
+static void sample_work_fn(struct work_struct *work)
+{
+    unsigned int interval = READ_ONCE(sample_interval_ms);
+    struct report_snapshot *snap;
+
+    if (!interval)
+        return;                 // Switched off since this run was queued
+
+    snap = scan_and_publish();
+    if (IS_ERR(snap))
+        printk(KERN_WARNING "helloModule: Background scan failed (%ld)\n", PTR_ERR(snap));
+    else
+        snapshot_put(snap);
+
+    queue_delayed_work(system_unbound_wq, &sample_work, msecs_to_jiffies(interval));
+}
+
+/**
+ * sample_interval_set - Apply a new sample_interval_ms written through sysfs.
+ *
+ * A non-zero interval starts sampling right away with the new period; zero
+ * stops it after the scan currently running, if any. sampler_lock keeps a
+ * write racing with helloModule_exit() from queueing the work after the
+ * exit path has cancelled it.
+ */
+static int sample_interval_set(const char *val, const struct kernel_param *kp)
+{
+    int ret = param_set_uint(val, kp);
+
+    if (ret)
+        return ret;
+
+    // At load time, helloModule_init() arms the work.
+    mutex_lock(&sampler_lock);
+    if (sampler_ready) {
+        if (READ_ONCE(sample_interval_ms))
+            mod_delayed_work(system_unbound_wq, &sample_work, 0);
+        else
+            cancel_delayed_work(&sample_work);
+    }
+    mutex_unlock(&sampler_lock);
+    return 0;
+}
+
+static const struct kernel_param_ops sample_interval_ops = {
+    .set = sample_interval_set,
+    .get = param_get_uint,
+};
+module_param_cb(sample_interval_ms, &sample_interval_ops, &sample_interval_ms, 0644);
+MODULE_PARM_DESC(sample_interval_ms,
+                 "Rescan in the background every N ms and serve the latest snapshot (0 = scan on open)");
+
+//----------------------------------
+//       /dev/procReport DEVICE
+//----------------------------------
+
+/**
+ * ring_dev_mmap - Map the ring read-only into a collector.
+ */
+static int ring_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    if (vma->vm_pgoff || vma->vm_end - vma->vm_start > ring.size)
+        return -EINVAL;
+
+    vma_clear_flags(vma, VM_MAYWRITE);
+    return remap_vmalloc_range(vma, ring.hdr, 0);
+}
+
+/**
+ * ring_dev_write - Run a scan and publish it to the ring.
+ *
+ * The written data is ignored; any write(2) to /dev/procReport is a scan
+ * request, so a collector never has to go through the CSV file.
+ */
+static ssize_t ring_dev_write(struct file *file, const char __user *buf,
+                              size_t count, loff_t *ppos)
+{
+    struct report_snapshot *snap = scan_and_publish();
+
+    if (IS_ERR(snap))
+        return PTR_ERR(snap);
+    snapshot_put(snap);
+    return count;
+}
+
+static const struct file_operations ring_dev_fops = {
+    .owner  = THIS_MODULE,
+    .mmap   = ring_dev_mmap,
+    .write  = ring_dev_write,
+    .llseek = noop_llseek,
+};
+
+static struct miscdevice ring_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name  = "procReport",
+    .fops  = &ring_dev_fops,
+    .mode  = 0400,      // Root only, like /proc/PID/pagemap
+};
+
+//----------------------------------
+//     ON-DEMAND SCAN REQUESTS
+//----------------------------------
+#define REQ_MAX_TICKETS 256     // Unread requests per open /dev/procReport_ctl
+
+/**
+ * struct scan_req - One walk asked for through /dev/procReport_ctl.
+ * @ref:        Held by the queued work and by each ticket.
+ * @node:       In req_queued until the walk starts, so others can join it.
+ * @work:       Runs the walk on scan_wq.
+ * @tickets:    Tickets waiting for the result.
+ * @ns:         PID namespace @pids are in.
+ * @detail:     PROCREPORT_DETAIL_* level.
+ * @flags:      PROCREPORT_SCAN_* flags.
+ * @nr_pids:    Entries in @pids, sorted and without duplicates.
+ * @pids:       Processes to walk.
+ * @done:       The result below is final.
+ * @status:     0 or a negative errno.
+ * @nr_records: Entries in @records.
+ * @records:    Result, TOTALS record last.
+ *
+ * Everything but @ref and the walk inputs is protected by req_mutex.
+ */
+struct scan_req {
+    refcount_t ref;
+    struct list_head node;
+    struct work_struct work;
+    struct list_head tickets;
+    struct pid_namespace *ns;
+    u32 detail;
+    u32 flags;
+    unsigned int nr_pids;
+    pid_t pids[PROCREPORT_REQ_MAX_PIDS];
+    bool done;
+    int status;
+    unsigned int nr_records;
+    struct procreport_record *records;
+};
+
+/**
+ * struct req_client - One open /dev/procReport_ctl.
+ * @tickets:    Its requests, in the order they were made.
+ * @nr_tickets: Entries in @tickets.
+ * @nr_done:    Tickets whose request is done, for poll() without the mutex.
+ * @wait:       Woken when a request of this client finishes.
+ */
+struct req_client {
+    struct list_head tickets;
+    unsigned int nr_tickets;
+    atomic_t nr_done;
+    wait_queue_head_t wait;
+};
+
+/**
+ * struct scan_ticket - A client's claim on the result of a request.
+ * @req_node:    In scan_req.tickets.
+ * @client_node: In req_client.tickets.
+ * @id:          Request ID handed to the client.
+ * @req:         Request, one reference held.
+ * @client:      Client that made the request.
+ */
+struct scan_ticket {
+    struct list_head req_node;
+    struct list_head client_node;
+    u64 id;
+    struct scan_req *req;
+    struct req_client *client;
+};
+
+static DEFINE_MUTEX(req_mutex);     // Protects requests, tickets and clients
+static LIST_HEAD(req_queued);       // Requests whose walk has not started
+static atomic64_t req_last_id;      // Last request ID handed out
+
+static void scan_req_put(struct scan_req *req)
+{
+    if (!refcount_dec_and_test(&req->ref))
+        return;
+    put_pid_ns(req->ns);
+    kvfree(req->records);
+    kfree(req);
+}
+
+/**
+ * scan_req_walk - Walk the processes of @req into its records.
+ * @req:     Request, not yet visible to readers as done.
+ * @records: Room for one record per PID and the totals.
+ *
+ * Returns the number of records written.
+ */
+static unsigned int scan_req_walk(struct scan_req *req, struct procreport_record *records)
+{
+    struct page_counts counts, totals = { 0 };
+    unsigned int i, n = 0;
+    u64 now;
+
+    for (i = 0; i < req->nr_pids; i++) {
+        struct walk_state ws = { 0 };
+        struct task_struct *task;
+        char comm[TASK_COMM_LEN];
+
+        rcu_read_lock();
+        task = pid_task(find_pid_ns(req->pids[i], req->ns), PIDTYPE_TGID);
+        if (task)
+            get_task_struct(task);
+        rcu_read_unlock();
+        if (!task)
+            continue;           // Exited since the request was made
+
+        get_task_comm(comm, task);
+        ws.sharing = req->flags & PROCREPORT_SCAN_PSS;
+        count_allocated_pages(task, &ws, &counts);
+        put_task_struct(task);
+        page_counts_add(&totals, &counts);
+        if (req->detail == PROCREPORT_DETAIL_PROCESSES)
+            fill_record(&records[n++], &counts, req->pids[i], comm, 0, 0, 0);
+    }
+
+    now = ktime_get_real_ns();
+    for (i = 0; i < n; i++)
+        records[i].timestamp_ns = now;
+    fill_record(&records[n++], &totals, -1, NULL, PROCREPORT_REC_TOTALS, now, 0);
+    return n;
+}
+
+/**
+ * scan_req_work - Run an on-demand scan and wake everybody waiting for it.
+ */
+static void scan_req_work(struct work_struct *work)
+{
+    struct scan_req *req = container_of(work, struct scan_req, work);
+    struct procreport_record *records;
+    struct scan_ticket *t;
+    unsigned int nr = 0;
+
+    // From here on a new identical request needs a walk of its own.
+    mutex_lock(&req_mutex);
+    list_del_init(&req->node);
+    mutex_unlock(&req_mutex);
+
+    records = kvcalloc(req->nr_pids + 1, sizeof(*records), GFP_KERNEL);
+    if (records)
+        nr = scan_req_walk(req, records);
+
+    mutex_lock(&req_mutex);
+    req->records = records;
+    req->nr_records = nr;
+    req->status = records ? 0 : -ENOMEM;
+    req->done = true;
+    list_for_each_entry(t, &req->tickets, req_node) {
+        atomic_inc(&t->client->nr_done);
+        wake_up_interruptible(&t->client->wait);
+    }
+    mutex_unlock(&req_mutex);
+    scan_req_put(req);          // Reference of the work
+}
+
+static int pid_cmp(const void *a, const void *b)
+{
+    pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * scan_req_find - A queued request identical to @key, or NULL.
+ *
+ * Only requests whose walk has not started qualify, so a joined result is
+ * never older than the request. The caller holds req_mutex.
+ */
+static struct scan_req *scan_req_find(const struct scan_req *key)
+{
+    struct scan_req *req;
+
+    list_for_each_entry(req, &req_queued, node) {
+        if (req->ns == key->ns && req->detail == key->detail && req->flags == key->flags &&
+            req->nr_pids == key->nr_pids &&
+            !memcmp(req->pids, key->pids, key->nr_pids * sizeof(*key->pids)))
+            return req;
+    }
+    return NULL;
+}
+
+/**
+ * req_dev_scan - PROCREPORT_IOC_SCAN: queue a scan and return its ID.
+ * @client: Client making the request.
+ * @ureq:   struct procreport_scan_request in userspace.
+ */
+static long req_dev_scan(struct req_client *client, struct procreport_scan_request __user *ureq)
+{
+    struct scan_req *key, *req;
+    struct scan_ticket *t;
+    unsigned int i, n;
+    u64 id;
+    long ret = 0;
+
+    key = kzalloc(sizeof(*key), GFP_KERNEL);
+    t = kzalloc(sizeof(*t), GFP_KERNEL);
+    if (!key || !t) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    if (get_user(key->nr_pids, &ureq->nr_pids) || get_user(key->detail, &ureq->detail) ||
+        get_user(key->flags, &ureq->flags) || get_user(i, &ureq->reserved)) {
+        ret = -EFAULT;
+        goto out;
+    }
+    if (!key->nr_pids || key->nr_pids > PROCREPORT_REQ_MAX_PIDS ||
+        key->detail > PROCREPORT_DETAIL_PROCESSES || key->flags & ~PROCREPORT_SCAN_PSS || i) {
+        ret = -EINVAL;
+        goto out;
+    }
+    if (copy_from_user(key->pids, ureq->pids, key->nr_pids * sizeof(*key->pids))) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    // Sorted and deduplicated, so the same set always compares equal.
+    sort(key->pids, key->nr_pids, sizeof(*key->pids), pid_cmp, NULL);
+    for (i = 1, n = 1; i < key->nr_pids; i++) {
+        if (key->pids[i] != key->pids[n - 1])
+            key->pids[n++] = key->pids[i];
+    }
+    key->nr_pids = n;
+    key->ns = task_active_pid_ns(current);
+
+    id = atomic64_inc_return(&req_last_id);
+    if (put_user(id, &ureq->id)) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    mutex_lock(&req_mutex);
+    if (client->nr_tickets >= REQ_MAX_TICKETS) {
+        mutex_unlock(&req_mutex);
+        ret = -EBUSY;
+        goto out;
+    }
+    req = scan_req_find(key);
+    if (!req) {
+        req = key;
+        key = NULL;
+        refcount_set(&req->ref, 1);     // Reference of the work
+        INIT_LIST_HEAD(&req->tickets);
+        INIT_WORK(&req->work, scan_req_work);
+        get_pid_ns(req->ns);
+        list_add_tail(&req->node, &req_queued);
+        queue_work(scan_wq, &req->work);
+    }
+    refcount_inc(&req->ref);
+    t->id = id;
+    t->req = req;
+    t->client = client;
+    list_add_tail(&t->req_node, &req->tickets);
+    list_add_tail(&t->client_node, &client->tickets);
+    client->nr_tickets++;
+    t = NULL;
+    mutex_unlock(&req_mutex);
+
+out:
+    kfree(t);
+    kfree(key);
+    return ret;
+}
+
+static long req_dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    switch (cmd) {
+    case PROCREPORT_IOC_SCAN:
+        return req_dev_scan(file->private_data, (void __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+// Drop @t and its request reference. The caller holds req_mutex.
+static void scan_ticket_drop(struct scan_ticket *t)
+{
+    list_del(&t->req_node);
+    list_del(&t->client_node);
+    t->client->nr_tickets--;
+    if (t->req->done)
+        atomic_dec(&t->client->nr_done);
+    scan_req_put(t->req);
+    kfree(t);
+}
+
+/**
+ * req_dev_read - Hand out the results of finished requests.
+ *
+ * Copies as many whole results as fit into @buf, oldest request first, and
+ * forgets them. Blocks until one is there unless the file is O_NONBLOCK.
+ */
+static ssize_t req_dev_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    struct req_client *client = file->private_data;
+    struct scan_ticket *t, *tmp;
+    ssize_t copied = 0;
+
+    if (!(file->f_flags & O_NONBLOCK) &&
+        wait_event_interruptible(client->wait, atomic_read(&client->nr_done)))
+        return -ERESTARTSYS;
+
+    mutex_lock(&req_mutex);
+    list_for_each_entry_safe(t, tmp, &client->tickets, client_node) {
+        struct scan_req *req = t->req;
+        size_t len = req->nr_records * sizeof(*req->records);
+        struct procreport_scan_done done = {
+            .id = t->id,
+            .status = req->status,
+            .nr_records = req->nr_records,
+            .header_size = sizeof(done),
+            .record_size = sizeof(*req->records),
+        };
+
+        if (!req->done)
+            continue;
+        if (sizeof(done) + len > count - copied) {
+            if (!copied)
+                copied = -EINVAL;
+            break;
+        }
+        if (copy_to_user(buf + copied, &done, sizeof(done)) ||
+            copy_to_user(buf + copied + sizeof(done), req->records, len)) {
+            if (!copied)
+                copied = -EFAULT;
+            break;
+        }
+        copied += sizeof(done) + len;
+        scan_ticket_drop(t);
+    }
+    mutex_unlock(&req_mutex);
+
+    // Another reader of the same file may have taken the results first.
+    return copied ? copied : -EAGAIN;
+}
+
+static __poll_t req_dev_poll(struct file *file, poll_table *wait)
+{
+    struct req_client *client = file->private_data;
+
+    poll_wait(file, &client->wait, wait);
+    return atomic_read(&client->nr_done) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static int req_dev_open(struct inode *inode, struct file *file)
+{
+    struct req_client *client = kzalloc(sizeof(*client), GFP_KERNEL);
+
+    if (!client)
+        return -ENOMEM;
+    INIT_LIST_HEAD(&client->tickets);
+    init_waitqueue_head(&client->wait);
+    file->private_data = client;
+    return nonseekable_open(inode, file);
+}
+
+/**
+ * req_dev_release - Forget the requests of a closed file.
+ *
+ * Walks still running finish into results nobody reads; their requests are
+ * freed when the work drops its reference.
+ */
+static int req_dev_release(struct inode *inode, struct file *file)
+{
+    struct req_client *client = file->private_data;
+    struct scan_ticket *t, *tmp;
+
+    mutex_lock(&req_mutex);
+    list_for_each_entry_safe(t, tmp, &client->tickets, client_node)
+        scan_ticket_drop(t);
+    mutex_unlock(&req_mutex);
+    kfree(client);
+    return 0;
+}
+
+static const struct file_operations req_dev_fops = {
+    .owner          = THIS_MODULE,
+    .open           = req_dev_open,
+    .release        = req_dev_release,
+    .read           = req_dev_read,
+    .poll           = req_dev_poll,
+    .unlocked_ioctl = req_dev_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+    .compat_ioctl   = compat_ptr_ioctl,     // Same layout for 32-bit callers
+#endif
+    .llseek         = noop_llseek,
+};
+
+// Any process can be named in a request, so root only.
+static struct miscdevice req_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name  = "procReport_ctl",
+    .fops  = &req_dev_fops,
+    .mode  = 0600,
+};
+
+static bool req_dev_registered;
+
+//----------------------------------
+//       /proc/procReport FILE
+//----------------------------------
+
+/**
+ * struct report_reader - State of one reader of /proc/procReport(_runs).
+ * @snap:   Snapshot being served, or NULL when the rows are streamed.
+ * @pos:    seq_file position of @cur.
+ * @cur:    Element at @pos: &@row, &@totals, or NULL past the end.
+ * @cursor: Streaming: PID (or target_pids entry) to look for processes from.
+ * @key:    Streaming: value of @cursor that found @row.
+ * @row:    Streaming: the process row at @pos.
+ * @totals: Streaming: sum of the rows the reader has moved past.
+ *
+ * A streaming reader holds no task, mm or per-process memory between
+ * read() calls, only this structure; processes are looked up by PID when
+ * the reader gets to them, so ones that exited in between are simply not
+ * found, and 30k processes cost no more kernel memory than three.
+ */
+struct report_reader {
+    struct report_snapshot *snap;
+    loff_t pos;
+    void *cur;
+    int cursor;
+    int key;
+    struct report_row row;
+    struct page_counts totals;
+};
+
+/**
+ * report_stream_find - Take a reference on the next process to stream.
+ * @cursor: PID (or target_pids entry) to look from.
+ * @key:    Set to the cursor value the process was found at.
+ *
+ * Without target_pids the cursor is a PID in the initial namespace and the
+ * PID allocator is searched from it, so every resume costs one lookup no
+ * matter how many processes came before. With target_pids, the smallest
+ * listed PID at or above the cursor is taken.
+ *
+ * Returns the process, or NULL when there are none left.
+ */
+static struct task_struct *report_stream_find(int cursor, int *key)
+{
+    struct task_struct *task = NULL;
+    struct pid *pid;
+    unsigned int i;
+    int nr = cursor;
+
+    // task_selected() reads the targets; targets_lock does not wait for
+    // the background or on-demand scan that may hold scan_mutex.
+    mutex_lock(&targets_lock);
+    rcu_read_lock();
+    if (targets.nr_pids) {
+        while (!task) {
+            int best = 0;
+
+            for (i = 0; i < targets.nr_pids; i++) {
+                if (targets.pids[i] >= nr && (!best || targets.pids[i] < best))
+                    best = targets.pids[i];
+            }
+            if (!best)
+                break;
+            task = pid_task(find_pid_ns(best, targets.pids_ns), PIDTYPE_TGID);
+            if (task && !task_selected(task, true))
+                task = NULL;
+            *key = best;
+            nr = best + 1;
+        }
+    } else {
+        while (!task && (pid = find_ge_pid(nr, &init_pid_ns))) {
+            nr = pid_nr(pid);
+            task = pid_task(pid, PIDTYPE_TGID);     // NULL for threads and groups
+            if (task && !task_selected(task, false))
+                task = NULL;
+            *key = nr++;
+        }
+    }
+    if (task)
+        get_task_struct(task);
+    rcu_read_unlock();
+    mutex_unlock(&targets_lock);
+    return task;
+}
+
+/**
+ * report_stream_fill - Walk the next process into the row at the cursor.
+ * @r: Reader.
+ *
+ * unique_mm_only needs every earlier address space to be remembered, so it
+ * does not apply to streamed rows.
+ *
+ * Returns &@r->row, &@r->totals once the processes ran out, or NULL.
+ */
+static void *report_stream_fill(struct report_reader *r)
+{
+    struct task_struct *task = report_stream_find(r->cursor, &r->key);
+    struct walk_state ws = { 0 };
+
+    if (!task)
+        return &r->totals;
+
+    memset(&r->row, 0, sizeof(r->row));
+    r->row.pid = task->pid;
+    r->row.start_time = task->start_time;
+    get_task_comm(r->row.comm, task);
+    count_allocated_pages(task, &ws, &r->row.counts);
+    put_task_struct(task);
+    return &r->row;
+}
+
+// Position 0 is the CSV header, 1..nr_rows the process rows, and the row
+// after the last process the TOTALS line. A streaming reader computes each
+// row in next() and keeps it until the reader moves on, so a row that did
+// not fit the seq_file buffer is shown again without walking it again.
+
+static void *report_seq_start(struct seq_file *m, loff_t *pos)
+{
+    struct report_reader *r = m->private;
+    struct report_snapshot *snap = r->snap;
+
+    if (*pos == 0) {
+        r->pos = 0;
+        r->cur = SEQ_START_TOKEN;
+        r->cursor = 0;
+        memset(&r->totals, 0, sizeof(r->totals));
+        return SEQ_START_TOKEN;
+    }
+    if (!snap)
+        return *pos == r->pos ? r->cur : NULL;     // seq_file resumes where next() left off
+    if (*pos <= snap->nr_rows)
+        return &snap->rows[*pos - 1];
+    if (*pos == snap->nr_rows + 1)
+        return &snap->totals;
+    return NULL;
+}
+
+static void *report_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+    struct report_reader *r = m->private;
+
+    ++*pos;
+    if (r->snap)
+        return report_seq_start(m, pos);
+
+    if (v == &r->row) {
+        page_counts_add(&r->totals, &r->row.counts);
+        r->cursor = r->key + 1;
+    }
+    r->cur = v == &r->totals ? NULL : report_stream_fill(r);
+    r->pos = *pos;
+    return r->cur;
+}
+
+static void report_seq_stop(struct seq_file *m, void *v)
+{
+}
+
+// The TOTALS element of whichever kind of report @r serves.
+static const struct page_counts *report_totals(const struct report_reader *r)
+{
+    return r->snap ? &r->snap->totals : &r->totals;
+}
+
+static int report_seq_show(struct seq_file *m, void *v)
+{
+    struct report_reader *r = m->private;
+    struct report_row *row = v;
+    const struct page_counts *counts;
+    unsigned int nr_nodes = min_t(unsigned int, nr_node_ids, PROCREPORT_MAX_NODES);
+    unsigned int i;
+
+    if (v == SEQ_START_TOKEN) {
+        // CSV header: pid, name, contig, noncontig, total, huge, then the
+        // swap/anon/file split, PSS (0 without pss_accounting) and one
+        // column per NUMA node; the last one takes any nodes beyond it.
+        seq_puts(m, "proc_id,proc_name,contig_pages,noncontig_pages,total_pages,huge_pages,"
+                    "swap_pages,anon_pages,file_pages,pss_kb");
+        for (i = 0; i < nr_nodes; i++)
+            seq_printf(m, ",node%u%s_pages", i,
+                       i == nr_nodes - 1 && nr_node_ids > nr_nodes ? "plus" : "");
+        seq_putc(m, '\n');
+        return 0;
+    }
+
+    if (v == report_totals(r)) {
+        counts = v;
+        seq_puts(m, "TOTALS,");
+    } else {
+        counts = &row->counts;
+        seq_printf(m, "%d,%s", row->pid, row->comm);
+    }
+    seq_printf(m, ",%lu,%lu,%lu,%lu,%lu,%lu,%lu,%llu",
+               counts->contig, counts->noncontig, counts->total, counts->huge,
+               counts->swap, counts->anon, counts->file,
+               (counts->pss * (PAGE_SIZE >> 10)) >> PSS_SHIFT);
+    for (i = 0; i < nr_nodes; i++)
+        seq_printf(m, ",%lu", counts->nodes[i]);
+    seq_putc(m, '\n');
+    return 0;
+}
+
+static const struct seq_operations report_seq_ops = {
+    .start = report_seq_start,
+    .next  = report_seq_next,
+    .stop  = report_seq_stop,
+    .show  = report_seq_show,
+};
+
+/**
+ * runs_seq_show - One line of /proc/procReport_runs.
+ *
+ * Same rows as /proc/procReport, but with the PMD alignment and the run
+ * length histogram instead of the page counts. Column run_N counts the runs
+ * of N to 2N - 1 pages; the last column also holds every longer run.
+ */
+static int runs_seq_show(struct seq_file *m, void *v)
+{
+    struct report_reader *r = m->private;
+    const struct page_counts *counts;
+    unsigned int i;
+
+    if (v == SEQ_START_TOKEN) {
+        seq_puts(m, "proc_id,proc_name,total_pages,huge_pages,pmd_aligned");
+        for (i = 0; i < PROCREPORT_RUN_BUCKETS; i++)
+            seq_printf(m, ",run_%lu", 1UL << i);
+        seq_putc(m, '\n');
+        return 0;
+    }
+
+    if (v == report_totals(r)) {
+        counts = v;
+        seq_puts(m, "TOTALS,");
+    } else {
+        struct report_row *row = v;
+
+        counts = &row->counts;
+        seq_printf(m, "%d,%s", row->pid, row->comm);
+    }
+    seq_printf(m, ",%lu,%lu,%lu", counts->total, counts->huge, counts->pmd_aligned);
+    for (i = 0; i < PROCREPORT_RUN_BUCKETS; i++)
+        seq_printf(m, ",%lu", counts->runs[i]);
+    seq_putc(m, '\n');
+    return 0;
+}
+
+static const struct seq_operations runs_seq_ops = {
+    .start = report_seq_start,
+    .next  = report_seq_next,
+    .stop  = report_seq_stop,
+    .show  = runs_seq_show,
+};
+
+/**
+ * report_open - Attach a report snapshot to a new reader of a report file.
+ *
+ * In periodic mode the latest background snapshot is served without waiting
+ * for the scan in progress; otherwise every open runs a fresh scan. Either
+ * way a reader sees one consistent snapshot no matter how many read() calls
+ * it takes to consume the CSV. With stream_report set and no background
+ * snapshot, nothing is scanned here: rows are walked one at a time as the
+ * reader consumes them, in PID order, and never go to the binary ring.
+ */
+static int report_attach(struct inode *inode, struct file *file, bool may_stream);
+
+static int report_open(struct inode *inode, struct file *file)
+{
+    return report_attach(inode, file, READ_ONCE(stream_report));
+}
+
+/**
+ * report_attach - Open a report file with a snapshot, or streaming.
+ * @may_stream: Allow serving the reader without a snapshot.
+ */
+static int report_attach(struct inode *inode, struct file *file, bool may_stream)
+{
+    struct report_snapshot *snap = NULL;
+    struct report_reader *r;
+
+    if (READ_ONCE(sample_interval_ms))
+        snap = snapshot_get_latest();
+    if (!snap && !may_stream)
+        snap = scan_and_publish();
+    if (IS_ERR(snap))
+        return PTR_ERR(snap);
+
+    // The proc entry data selects the columns (report_seq_ops or runs_seq_ops).
+    r = __seq_open_private(file, pde_data(inode), sizeof(*r));
+    if (!r) {
+        snapshot_put(snap);
+        return -ENOMEM;
+    }
+    r->snap = snap;
+    return 0;
+}
+
+static int report_release(struct inode *inode, struct file *file)
+{
+    struct report_reader *r = ((struct seq_file *)file->private_data)->private;
+
+    snapshot_put(r->snap);
+    return seq_release_private(inode, file);
+}
+
+static struct proc_dir_entry *report_entry;    // /proc/procReport
+static struct proc_dir_entry *runs_entry;      // /proc/procReport_runs
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+static const struct proc_ops report_proc_ops = {
+    .proc_open    = report_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = report_release,
+};
+#else
+static const struct file_operations report_proc_ops = {
+    .owner   = THIS_MODULE,
+    .open    = report_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = report_release,
+};
+#endif
+
+/**
+ * physmap_seq_show - One line of /proc/procReport_physmap.
+ *
+ * One row per huge-page size, counting the physical blocks of that size by
+ * how much of them the scanned processes map; see struct phys_row.
+ */
+static int physmap_seq_show(struct seq_file *m, void *v)
+{
+    struct report_reader *r = m->private;
+    const struct phys_row *row = v;
+
+    if (v == SEQ_START_TOKEN) {
+        if (!r->snap->phys.valid)
+            seq_puts(m, "# no physical map in this scan, set phys_map=Y\n");
+        seq_puts(m, "block_size,blocks,unmapped,sparse,partial,full\n");
+        return 0;
+    }
+
+    seq_printf(m, "%s,%lu,%lu,%lu,%lu,%lu\n", row->name, row->blocks,
+               row->unmapped, row->sparse, row->partial, row->full);
+    return 0;
+}
+
+// Position 0 is the CSV header, 1..PHYS_NR_SIZES the rows of the snapshot.
+static void *physmap_seq_start(struct seq_file *m, loff_t *pos)
+{
+    struct report_reader *r = m->private;
+
+    if (*pos == 0)
+        return SEQ_START_TOKEN;
+    if (*pos > PHYS_NR_SIZES || !r->snap->phys.valid)
+        return NULL;
+    return &r->snap->phys.rows[*pos - 1];
+}
+
+static void *physmap_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+    ++*pos;
+    return physmap_seq_start(m, pos);
+}
+
+static const struct seq_operations physmap_seq_ops = {
+    .start = physmap_seq_start,
+    .next  = physmap_seq_next,
+    .stop  = report_seq_stop,
+    .show  = physmap_seq_show,
+};
+
+/**
+ * pins_seq_show - One line of /proc/procReport_physmap_pins.
+ *
+ * Same rows as /proc/procReport: the sparse 2 MiB blocks charged to each
+ * process and the pages it maps in them. Those few pages are what keeps a
+ * nearly free block from being compacted into a huge page.
+ */
+static int pins_seq_show(struct seq_file *m, void *v)
+{
+    struct report_reader *r = m->private;
+    const struct page_counts *counts;
+
+    if (v == SEQ_START_TOKEN) {
+        seq_puts(m, "proc_id,proc_name,total_pages,sparse_blocks,sparse_block_pages\n");
+        return 0;
+    }
+
+    if (v == report_totals(r)) {
+        counts = v;
+        seq_puts(m, "TOTALS,");
+    } else {
+        struct report_row *row = v;
+
+        counts = &row->counts;
+        seq_printf(m, "%d,%s", row->pid, row->comm);
+    }
+    seq_printf(m, ",%lu,%lu,%lu\n", counts->total, counts->sparse_blocks, counts->sparse_pages);
+    return 0;
+}
+
+static const struct seq_operations pins_seq_ops = {
+    .start = report_seq_start,
+    .next  = report_seq_next,
+    .stop  = report_seq_stop,
+    .show  = pins_seq_show,
+};
+
+// The physical map only exists in snapshots, so these never stream.
+static int physmap_open(struct inode *inode, struct file *file)
+{
+    return report_attach(inode, file, false);
+}
+
+static struct proc_dir_entry *physmap_entry;   // /proc/procReport_physmap
+static struct proc_dir_entry *pins_entry;      // /proc/procReport_physmap_pins
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+static const struct proc_ops physmap_proc_ops = {
+    .proc_open    = physmap_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = report_release,
+};
+#else
+static const struct file_operations physmap_proc_ops = {
+    .owner   = THIS_MODULE,
+    .open    = physmap_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = report_release,
+};
+#endif
+
+//----------------------------------
+//         DELTA REPORTS
+//----------------------------------
+
+// /proc/procReport_delta compares the snapshot it serves with the one it
+// served last time and only lists what changed: processes that appeared
+// ("new"), exited ("exit"), or whose contig, noncontig or total pages moved
+// by more than delta_threshold ("change"). The first read lists every
+// process as new. The baseline is shared, so the file is meant for a single
+// collector; in periodic mode a read before the next sample is empty.
+
+static DEFINE_MUTEX(delta_lock);
+static struct report_snapshot *delta_base;     // Last snapshot served, under delta_lock
+
+/**
+ * struct delta_key - Sort key of one snapshot row.
+ * @pid:        Process ID of the row.
+ * @row:        Index of the row in its snapshot.
+ * @start_time: Start time of the process, so a reused PID is a new process.
+ */
+struct delta_key {
+    pid_t pid;
+    u32 row;
+    u64 start_time;
+};
+
+/**
+ * struct delta_event - One line of the delta report.
+ * @event:       "new", "exit" or "change".
+ * @row:         Row the event is about, from the old snapshot for "exit".
+ * @d_contig:    Change of contig_pages.
+ * @d_noncontig: Change of noncontig_pages.
+ * @d_total:     Change of total_pages.
+ */
+struct delta_event {
+    const char *event;
+    const struct report_row *row;
+    long d_contig;
+    long d_noncontig;
+    long d_total;
+};
+
+/**
+ * struct delta_reader - State of one reader of /proc/procReport_delta.
+ * @base:      Snapshot served before, or NULL on the first read.
+ * @snap:      Snapshot being served.
+ * @base_keys: Rows of @base sorted by pid and start time.
+ * @keys:      Rows of @snap, likewise.
+ * @i:         Next entry of @base_keys to look at.
+ * @j:         Next entry of @keys to look at.
+ * @pos:       seq_file position of @cur.
+ * @cur:       Element at @pos: &@ev, or NULL past the end.
+ * @ev:        The event at @pos.
+ *
+ * Both key lists are walked in one merge pass; as in struct report_reader,
+ * the cursors move when an event is produced, and the event is kept for
+ * seq_file to show again if needed.
+ */
+struct delta_reader {
+    struct report_snapshot *base;
+    struct report_snapshot *snap;
+    struct delta_key *base_keys;
+    struct delta_key *keys;
+    unsigned int i;
+    unsigned int j;
+    loff_t pos;
+    void *cur;
+    struct delta_event ev;
+};
+
+static int delta_key_cmp(const void *a, const void *b)
+{
+    const struct delta_key *ka = a, *kb = b;
+
+    if (ka->pid != kb->pid)
+        return ka->pid < kb->pid ? -1 : 1;
+    if (ka->start_time != kb->start_time)
+        return ka->start_time < kb->start_time ? -1 : 1;
+    return 0;
+}
+
+/**
+ * delta_keys - Build the sorted key list of a snapshot.
+ * @snap: Snapshot, or NULL for an empty list.
+ *
+ * Returns the keys, ZERO_SIZE_PTR for no rows, or NULL without memory.
+ */
+static struct delta_key *delta_keys(const struct report_snapshot *snap)
+{
+    unsigned int nr = snap ? snap->nr_rows : 0;
+    struct delta_key *keys;
+    unsigned int i;
+
+    keys = kvmalloc_array(nr, sizeof(*keys), GFP_KERNEL);
+    if (!nr || !keys)
+        return keys;
+    for (i = 0; i < nr; i++) {
+        keys[i].pid = snap->rows[i].pid;
+        keys[i].row = i;
+        keys[i].start_time = snap->rows[i].start_time;
+    }
+    sort(keys, nr, sizeof(*keys), delta_key_cmp, NULL);
+    return keys;
+}
+
+// Moved by more than delta_threshold pages, either way.
+static bool delta_moved(long delta, unsigned int threshold)
+{
+    return delta > (long)threshold || delta < -(long)threshold;
+}
 
 /**
- * virt2phys - Convert a virtual page address to its corresponding physical address.
- * @mm:   Pointer to the memory map of the process.
- * @vaddr: Virtual address to be translated.
+ * delta_fill - Find the next event from the merge cursors.
+ * @r: Reader.
  *
- * Returns the physical address if the page is present; otherwise returns 0.
+ * Returns &@r->ev, or NULL once both snapshots are exhausted.
  */
-unsigned long virt2phys(struct mm_struct *mm, unsigned long vaddr)
+static void *delta_fill(struct delta_reader *r)
+{
+    unsigned int nr_base = r->base ? r->base->nr_rows : 0;
+    unsigned int threshold = READ_ONCE(delta_threshold);
+    const struct page_counts *old, *new;
+    int cmp;
+
+    while (r->i < nr_base || r->j < r->snap->nr_rows) {
+        if (r->i == nr_base)
+            cmp = 1;
+        else if (r->j == r->snap->nr_rows)
+            cmp = -1;
+        else
+            cmp = delta_key_cmp(&r->base_keys[r->i], &r->keys[r->j]);
+
+        if (cmp < 0) {
+            r->ev.event = "exit";
+            r->ev.row = &r->base->rows[r->base_keys[r->i++].row];
+            r->ev.d_contig = -(long)r->ev.row->counts.contig;
+            r->ev.d_noncontig = -(long)r->ev.row->counts.noncontig;
+            r->ev.d_total = -(long)r->ev.row->counts.total;
+            return &r->ev;
+        }
+        if (cmp > 0) {
+            r->ev.event = "new";
+            r->ev.row = &r->snap->rows[r->keys[r->j++].row];
+            r->ev.d_contig = r->ev.row->counts.contig;
+            r->ev.d_noncontig = r->ev.row->counts.noncontig;
+            r->ev.d_total = r->ev.row->counts.total;
+            return &r->ev;
+        }
+
+        old = &r->base->rows[r->base_keys[r->i++].row].counts;
+        r->ev.row = &r->snap->rows[r->keys[r->j++].row];
+        new = &r->ev.row->counts;
+        r->ev.event = "change";
+        r->ev.d_contig = (long)new->contig - (long)old->contig;
+        r->ev.d_noncontig = (long)new->noncontig - (long)old->noncontig;
+        r->ev.d_total = (long)new->total - (long)old->total;
+        if (delta_moved(r->ev.d_contig, threshold) ||
+            delta_moved(r->ev.d_noncontig, threshold) ||
+            delta_moved(r->ev.d_total, threshold))
+            return &r->ev;
+    }
+    return NULL;
+}
+
+// Position 0 is the CSV header, every later position the next event.
+
+static void *delta_seq_start(struct seq_file *m, loff_t *pos)
 {
-    pgd_t *pgd_entry;           // Page Global Directory pointer
-    p4d_t *p4d_entry;           // Page 4th-level Directory pointer
-    pud_t *pud_entry;           // Page Upper Directory pointer
-    pmd_t *pmd_entry;           // Page Middle Directory pointer
-    pte_t *pte_entry;           // Page Table Entry pointer
-    struct page *page_ptr;      // Pointer to the "struct page" for this address
+    struct delta_reader *r = m->private;
 
-    // Retrieve the first-level (PGD) entry.
-    pgd_entry = pgd_offset(mm, vaddr);  
-    if (pgd_none(*pgd_entry) || pgd_bad(*pgd_entry))
-        return 0;               // If PGD doesn't exist or is invalid, return 0.
+    if (*pos == 0) {
+        r->i = 0;
+        r->j = 0;
+        r->pos = 0;
+        return SEQ_START_TOKEN;
+    }
+    return *pos == r->pos ? r->cur : NULL;
+}
 
-    // Retrieve the 4th-level (P4D) entry.
-    p4d_entry = p4d_offset(pgd_entry, vaddr); 
-    if (p4d_none(*p4d_entry) || p4d_bad(*p4d_entry))
-        return 0;               // If P4D is invalid, return 0.
+static void *delta_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+    struct delta_reader *r = m->private;
 
-    // Retrieve the upper-level (PUD) entry.
-    pud_entry = pud_offset(p4d_entry, vaddr);
-    if (pud_none(*pud_entry) || pud_bad(*pud_entry))
-        return 0;               // If PUD is invalid, return 0.
+    r->pos = ++*pos;
+    r->cur = delta_fill(r);
+    return r->cur;
+}
 
-    // Retrieve the middle-level (PMD) entry.
-    pmd_entry = pmd_offset(pud_entry, vaddr);
-    if (pmd_none(*pmd_entry) || pmd_bad(*pmd_entry))
-        return 0;               // If PMD is invalid, return 0.
+static void delta_seq_stop(struct seq_file *m, void *v)
+{
+}
 
-    // Map the page table entry (PTE) into kernel space.
-    pte_entry = pte_offset_map(pmd_entry, vaddr);
-    if (!pte_entry)
-        return 0;               // If pte_offset_map failed, return 0.
+static int delta_seq_show(struct seq_file *m, void *v)
+{
+    const struct delta_event *ev = v;
+    const struct page_counts *counts;
 
-    // Check if the PTE corresponds to a valid physical page.
-    page_ptr = pte_page(*pte_entry);
-    if (!page_ptr) {
-        pte_unmap(pte_entry);   // Unmap before returning
+    if (v == SEQ_START_TOKEN) {
+        // Counts are those after the event (before it for "exit"); the
+        // deltas are against the previous read.
+        seq_puts(m, "event,proc_id,proc_name,contig_pages,noncontig_pages,total_pages,"
+                    "delta_contig,delta_noncontig,delta_total\n");
         return 0;
     }
 
-    // Obtain the physical address from the page structure.
-    {
-        unsigned long phys_addr = page_to_phys(page_ptr); 
-        pte_unmap(pte_entry);   // Unmap the PTE now that we're done
+    counts = &ev->row->counts;
+    seq_printf(m, "%s,%d,%s,%lu,%lu,%lu,%ld,%ld,%ld\n", ev->event, ev->row->pid,
+               ev->row->comm, counts->contig, counts->noncontig, counts->total,
+               ev->d_contig, ev->d_noncontig, ev->d_total);
+    return 0;
+}
+
+static const struct seq_operations delta_seq_ops = {
+    .start = delta_seq_start,
+    .next  = delta_seq_next,
+    .stop  = delta_seq_stop,
+    .show  = delta_seq_show,
+};
+
+/**
+ * delta_open - Diff a new snapshot against the one served last time.
+ *
+ * The snapshot is taken the same way as for /proc/procReport, except that
+ * stream_report is ignored: a delta needs a whole snapshot to compare. The
+ * baseline only moves on once the reader is set up, so a failed open does
+ * not lose any events.
+ */
+static int delta_open(struct inode *inode, struct file *file)
+{
+    struct report_snapshot *snap = NULL;
+    struct delta_reader *r;
+
+    if (READ_ONCE(sample_interval_ms))
+        snap = snapshot_get_latest();
+    if (!snap)
+        snap = scan_and_publish();
+    if (IS_ERR(snap))
+        return PTR_ERR(snap);
 
-        // Optional check if this address is a special "unmapped" sentinel.
-        if (phys_addr == 70368744173568ULL)
-            return 0;
+    r = __seq_open_private(file, &delta_seq_ops, sizeof(*r));
+    if (!r) {
+        snapshot_put(snap);
+        return -ENOMEM;
+    }
+    r->snap = snap;
 
-        return phys_addr;       // Return the resolved physical address
+    mutex_lock(&delta_lock);
+    r->base_keys = delta_keys(delta_base);
+    r->keys = delta_keys(snap);
+    if (!r->base_keys || !r->keys) {
+        mutex_unlock(&delta_lock);
+        kvfree(r->base_keys);
+        kvfree(r->keys);
+        snapshot_put(snap);
+        seq_release_private(inode, file);
+        return -ENOMEM;
     }
+    r->base = delta_base;               // The reader takes over its reference
+    refcount_inc(&snap->ref);
+    delta_base = snap;
+    mutex_unlock(&delta_lock);
+    return 0;
+}
+
+static int delta_release(struct inode *inode, struct file *file)
+{
+    struct delta_reader *r = ((struct seq_file *)file->private_data)->private;
+
+    kvfree(r->base_keys);
+    kvfree(r->keys);
+    snapshot_put(r->base);
+    snapshot_put(r->snap);
+    return seq_release_private(inode, file);
 }
 
+static struct proc_dir_entry *delta_entry;     // /proc/procReport_delta
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+static const struct proc_ops delta_proc_ops = {
+    .proc_open    = delta_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = delta_release,
+};
+#else
+static const struct file_operations delta_proc_ops = {
+    .owner   = THIS_MODULE,
+    .open    = delta_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = delta_release,
+};
+#endif
+
+//----------------------------------
+//        SAMPLED ESTIMATES
+//----------------------------------
+
+// /proc/procReport_estimate reports total, contig and noncontig pages per
+// process from a walk of only estimate_permille of the PTE tables, with 95%
+// confidence intervals (estimate +/- ci95). With estimate_exact set, every
+// process is walked exactly as well and both results and walk times are
+// listed side by side. Rows are streamed in PID order like /proc/procReport
+// with stream_report set; the TOTALS interval assumes independent processes.
+
 /**
- * count_allocated_pages - Count physical pages for a given process.
- * @task:       Pointer to the process's task_struct.
- * @total:      Pointer to the total allocated pages count.
- * @contig:     Pointer to count of contiguous pages (optional).
- * @noncontig:  Pointer to count of non-contiguous pages (optional).
- *
- * This function iterates over each virtual memory area (VMA) in the process's
- * memory map and, for every page, it attempts to translate the virtual address
- * to a physical address. If successful, it updates the page counts.
- */
-void count_allocated_pages(struct task_struct *task, unsigned long *total,
-                           unsigned long *contig, unsigned long *noncontig)
-{
-    struct vm_area_struct *area;  // Used to walk the list of VM areas
-    unsigned long vaddr;          // Current virtual address in the VMA
-    unsigned long prev_phys = 0;  // Stores previous page's physical address
-
-    // Initialize counts to zero before we start.
-    *total = 0;
-    if (contig)
-        *contig = 0;
-    if (noncontig)
-        *noncontig = 0;
-
-    // Check if the task's mm (memory map) exists and has a starting VMA.
-    if (task->mm && task->mm->mmap) {
-        // For every virtual memory area in this task
-        for (area = task->mm->mmap; area; area = area->vm_next) {
-            // Step through each page in the VMA.
-            for (vaddr = area->vm_start; vaddr < area->vm_end; vaddr += PAGE_SIZE) {
-                // Translate virtual address to physical address.
-                unsigned long phys = virt2phys(task->mm, vaddr);
-
-                if (phys == 0)
-                    continue;          // Skip if it's not mapped (unallocated)
-
-                // We found a valid physical page, increment total count.
-                (*total)++;
-
-                // If contig and noncontig pointers are valid, check contiguity.
-                if (contig && noncontig) {
-                    // If this is not the first page in the VMA
-                    if (prev_phys != 0) {
-                        // Check if current physical address is PAGE_SIZE after the previous
-                        if (phys == prev_phys + PAGE_SIZE)
-                            (*contig)++;
-                        else
-                            (*noncontig)++;
-                    }
-                    // Update prev_phys to current page's address
-                    prev_phys = phys;
-                }
+ * struct estimate_row - One process line of the estimate report.
+ * @pid:      Process ID.
+ * @comm:     Process name.
+ * @est:      Estimated counts, indexed by EST_*.
+ * @var:      Estimated variance of @est.
+ * @exact:    Counts from an exact walk, if estimate_exact is set.
+ * @walk_ns:  Time the sampled walk took.
+ * @exact_ns: Time the exact walk took, 0 without estimate_exact.
+ */
+struct estimate_row {
+    pid_t pid;
+    char comm[TASK_COMM_LEN];
+    u64 est[EST_NR];
+    u64 var[EST_NR];
+    u64 exact[EST_NR];
+    u64 walk_ns;
+    u64 exact_ns;
+};
+
+/**
+ * struct estimate_reader - State of one reader of /proc/procReport_estimate.
+ * @pos:    seq_file position of @cur.
+ * @cur:    Element at @pos: &@row, &@totals, or NULL past the end.
+ * @cursor: PID (or target_pids entry) to look for processes from.
+ * @key:    Value of @cursor that found @row.
+ * @every:  One PTE table in this many is walked.
+ * @exact:  Exact walks are done too.
+ * @seed:   Random seed of this read, so rereads sample the same tables.
+ * @row:    The process row at @pos.
+ * @totals: Sum of the rows the reader has moved past.
+ */
+struct estimate_reader {
+    loff_t pos;
+    void *cur;
+    int cursor;
+    int key;
+    unsigned int every;
+    bool exact;
+    u32 seed;
+    struct estimate_row row;
+    struct estimate_row totals;
+};
+
+static void estimate_row_from(u64 *dst, const struct page_counts *counts)
+{
+    dst[EST_TOTAL] = counts->total;
+    dst[EST_CONTIG] = counts->contig;
+    dst[EST_NONCONTIG] = counts->noncontig;
+}
+
+/**
+ * estimate_fill - Walk the next process into the row at the cursor.
+ * @r: Reader.
+ *
+ * The sampled walk is the regular batched walker with sampling switched on
+ * in its walk state, so both walks count pages by the same rules.
+ *
+ * Returns &@r->row, &@r->totals once the processes ran out, or NULL.
+ */
+static void *estimate_fill(struct estimate_reader *r)
+{
+    struct task_struct *task = report_stream_find(r->cursor, &r->key);
+    struct estimate_row *row = &r->row;
+    struct walk_state ws = { 0 };
+    struct page_counts counts;
+    u64 start;
+    int i;
+
+    if (!task)
+        return &r->totals;
+
+    memset(row, 0, sizeof(*row));
+    row->pid = task->pid;
+    get_task_comm(row->comm, task);
+
+    ws.sample_every = r->every;
+    ws.sample_seed = r->seed;
+    start = ktime_get_ns();
+    if (!count_allocated_pages(task, &ws, &counts))
+        goto out;               // Kernel thread
+    row->walk_ns = ktime_get_ns() - start;
+    estimate_row_from(row->est, &counts);
+    for (i = 0; i < EST_NR; i++) {
+        row->est[i] += ws.est.extra[i];
+        row->var[i] = ws.est.var[i];
+    }
+
+    if (r->exact) {
+        memset(&ws, 0, sizeof(ws));
+        start = ktime_get_ns();
+        count_allocated_pages(task, &ws, &counts);
+        row->exact_ns = ktime_get_ns() - start;
+        estimate_row_from(row->exact, &counts);
+    }
+out:
+    put_task_struct(task);
+    return row;
+}
+
+static void estimate_row_add(struct estimate_row *dst, const struct estimate_row *src)
+{
+    int i;
+
+    for (i = 0; i < EST_NR; i++) {
+        dst->est[i] += src->est[i];
+        dst->var[i] += src->var[i];
+        dst->exact[i] += src->exact[i];
+    }
+    dst->walk_ns += src->walk_ns;
+    dst->exact_ns += src->exact_ns;
+}
+
+// Position 0 is the CSV header, 1..n the process rows, then TOTALS; the
+// row at the cursor is kept as in report_seq_start().
+
+static void *estimate_seq_start(struct seq_file *m, loff_t *pos)
+{
+    struct estimate_reader *r = m->private;
+
+    if (*pos == 0) {
+        r->pos = 0;
+        r->cursor = 0;
+        memset(&r->totals, 0, sizeof(r->totals));
+        return SEQ_START_TOKEN;
+    }
+    return *pos == r->pos ? r->cur : NULL;
+}
+
+static void *estimate_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+    struct estimate_reader *r = m->private;
+
+    ++*pos;
+    if (v == &r->row) {
+        estimate_row_add(&r->totals, &r->row);
+        r->cursor = r->key + 1;
+    }
+    r->cur = v == &r->totals ? NULL : estimate_fill(r);
+    r->pos = *pos;
+    return r->cur;
+}
+
+static void estimate_seq_stop(struct seq_file *m, void *v)
+{
+}
+
+static int estimate_seq_show(struct seq_file *m, void *v)
+{
+    struct estimate_reader *r = m->private;
+    const struct estimate_row *row = v;
+    int i;
+
+    if (v == SEQ_START_TOKEN) {
+        seq_puts(m, "proc_id,proc_name,sample_permille,est_total_pages,total_ci95,"
+                    "est_contig_pages,contig_ci95,est_noncontig_pages,noncontig_ci95,"
+                    "walk_us,exact_total_pages,exact_contig_pages,exact_noncontig_pages,"
+                    "exact_walk_us\n");
+        return 0;
+    }
+
+    if (v == &r->totals)
+        seq_puts(m, "TOTALS,");
+    else
+        seq_printf(m, "%d,%s", row->pid, row->comm);
+    seq_printf(m, ",%u", 1000 / r->every);
+    for (i = 0; i < EST_NR; i++)
+        seq_printf(m, ",%llu,%llu", row->est[i], div_u64(int_sqrt64(row->var[i]) * 196, 100));
+    seq_printf(m, ",%llu", div_u64(row->walk_ns, NSEC_PER_USEC));
+    if (r->exact) {
+        for (i = 0; i < EST_NR; i++)
+            seq_printf(m, ",%llu", row->exact[i]);
+        seq_printf(m, ",%llu\n", div_u64(row->exact_ns, NSEC_PER_USEC));
+    } else {
+        seq_puts(m, ",,,,\n");
+    }
+    return 0;
+}
+
+static const struct seq_operations estimate_seq_ops = {
+    .start = estimate_seq_start,
+    .next  = estimate_seq_next,
+    .stop  = estimate_seq_stop,
+    .show  = estimate_seq_show,
+};
+
+static int estimate_open(struct inode *inode, struct file *file)
+{
+    unsigned int permille = clamp(READ_ONCE(estimate_permille), 1U, 1000U);
+    struct estimate_reader *r;
+
+    r = __seq_open_private(file, &estimate_seq_ops, sizeof(*r));
+    if (!r)
+        return -ENOMEM;
+    r->every = DIV_ROUND_CLOSEST(1000, permille);
+    r->exact = READ_ONCE(estimate_exact);
+    r->seed = get_random_u32();
+    return 0;
+}
+
+static struct proc_dir_entry *estimate_entry;  // /proc/procReport_estimate
+static struct proc_dir_entry *live_entry;      // /proc/procReport_live
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+static const struct proc_ops estimate_proc_ops = {
+    .proc_open    = estimate_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = seq_release_private,
+};
+#else
+static const struct file_operations estimate_proc_ops = {
+    .owner   = THIS_MODULE,
+    .open    = estimate_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = seq_release_private,
+};
+#endif
+
+//----------------------------------
+//       PER-VMA BREAKDOWN
+//----------------------------------
+
+// /proc/procReport_vmas (CSV) and /proc/procReport_vmas.bin (binary records,
+// see procReport_abi.h) list every VMA of the selected processes, then the
+// per-class sums of each process, then the per-class sums of all of them.
+// Rows are walked as the reader consumes them, so the kernel never holds
+// more than one row no matter how many VMAs a process has.
+
+static const char *const vma_class_names[PROCREPORT_VMA_NR_CLASSES] = {
+    [PROCREPORT_VMA_ANON]      = "anon",
+    [PROCREPORT_VMA_HEAP]      = "heap",
+    [PROCREPORT_VMA_STACK]     = "stack",
+    [PROCREPORT_VMA_FILE_TEXT] = "file_text",
+    [PROCREPORT_VMA_FILE_DATA] = "file_data",
+    [PROCREPORT_VMA_SHMEM]     = "shmem",
+    [PROCREPORT_VMA_DEVICE]    = "device",
+};
+
+/**
+ * struct vma_class_sum - VMAs of one class summed up.
+ * @nr_vmas: VMAs added so far.
+ * @counts:  Sum of their page counts.
+ */
+struct vma_class_sum {
+    unsigned long nr_vmas;
+    struct page_counts counts;
+};
+
+/**
+ * struct vma_report - State of one reader of the per-VMA files.
+ * @job:     Processes to report; task references only, no mm is pinned.
+ * @binary:  Emit procreport_vma_record structures instead of CSV.
+ * @item:    Index into @job.items of the process the cursor is in.
+ * @addr:    Next VMA of that process is the first ending above this address.
+ * @cls:     Class of the next rollup row, or -1 while still on VMAs.
+ * @all_cls: Class of the next system-wide totals row.
+ * @mm:      Memory map of the current process, pinned between start and stop.
+ * @proc:    Per-class sums of the current process.
+ * @all:     Per-class sums of every process.
+ * @rec:     The row at the cursor.
+ *
+ * seq_file may show a row more than once (the buffer overflowed, or the
+ * reader seeked back), so sums are only updated when the cursor moves past
+ * a row in vma_report_next(), and rewound with the cursor at position 0.
+ */
+struct vma_report {
+    struct scan_job job;
+    bool binary;
+    unsigned int item;
+    unsigned long addr;
+    int cls;
+    int all_cls;
+    struct mm_struct *mm;
+    struct vma_class_sum proc[PROCREPORT_VMA_NR_CLASSES];
+    struct vma_class_sum all[PROCREPORT_VMA_NR_CLASSES];
+    struct procreport_vma_record rec;
+};
+
+/**
+ * vma_classify - Sort a VMA into one of the PROCREPORT_VMA_* classes.
+ * @vma: VMA to classify; the caller holds mmap_read_lock().
+ *
+ * Heap and stack are recognized the same way /proc/PID/maps labels them.
+ */
+static u32 vma_classify(struct vm_area_struct *vma)
+{
+    struct mm_struct *mm = vma->vm_mm;
+
+    if (vma->vm_flags & (VM_IO | VM_PFNMAP | VM_MIXEDMAP))
+        return PROCREPORT_VMA_DEVICE;
+    if (vma->vm_file) {
+        // Shared anonymous and SysV memory are shmem files too.
+        if (shmem_file(vma->vm_file))
+            return PROCREPORT_VMA_SHMEM;
+        return (vma->vm_flags & VM_EXEC) ? PROCREPORT_VMA_FILE_TEXT
+                                         : PROCREPORT_VMA_FILE_DATA;
+    }
+    if (vma->vm_start <= mm->brk && vma->vm_end >= mm->start_brk)
+        return PROCREPORT_VMA_HEAP;
+    if ((vma->vm_flags & (VM_GROWSDOWN | VM_GROWSUP)) ||
+        (vma->vm_start <= mm->start_stack && vma->vm_end >= mm->start_stack))
+        return PROCREPORT_VMA_STACK;
+    return PROCREPORT_VMA_ANON;
+}
+
+static void vma_record_counts(struct procreport_vma_record *rec,
+                              const struct page_counts *counts)
+{
+    rec->contig = counts->contig;
+    rec->noncontig = counts->noncontig;
+    rec->total = counts->total;
+    rec->huge = counts->huge;
+}
+
+static void vma_sum_add(struct vma_class_sum *sum, const struct procreport_vma_record *rec)
+{
+    sum->nr_vmas++;
+    sum->counts.contig += rec->contig;
+    sum->counts.noncontig += rec->noncontig;
+    sum->counts.total += rec->total;
+    sum->counts.huge += rec->huge;
+}
+
+/**
+ * vma_report_fill_vma - Make the first VMA at or after the cursor the next row.
+ * @r: Reader state; @r->mm is pinned.
+ *
+ * mmap_lock is only held to look the VMA up; its pages are then walked in
+ * lock_hold_us batches like a regular scan.
+ *
+ * Returns false once the process has no VMAs left.
+ */
+static bool vma_report_fill_vma(struct vma_report *r)
+{
+    struct procreport_vma_record *rec = &r->rec;
+    struct walk_state ws = { 0 };
+    struct page_counts counts;
+    struct vm_area_struct *vma;
+
+    mmap_read_lock(r->mm);
+    vma = find_vma(r->mm, r->addr);
+    if (vma) {
+        memset(rec, 0, sizeof(*rec));
+        rec->pid = r->job.items[r->item].task->pid;
+        get_task_comm(rec->comm, r->job.items[r->item].task);
+        rec->vma_class = vma_classify(vma);
+        rec->start = vma->vm_start;
+        rec->end = vma->vm_end;
+        rec->vm_flags = vma->vm_flags;
+        rec->inode = vma->vm_file ? file_inode(vma->vm_file)->i_ino : 0;
+        rec->nr_vmas = 1;
+    }
+    mmap_read_unlock(r->mm);
+    if (!vma)
+        return false;
+
+    walk_mm_range_batched(&ws, r->mm, rec->start, rec->end);
+    finish_walk(&ws, &counts);
+    vma_record_counts(rec, &counts);
+    return true;
+}
+
+/**
+ * vma_report_fill_sum - Make a per-class sum the next row.
+ * @r:     Reader state.
+ * @sum:   Sum to report.
+ * @cls:   Class of @sum.
+ * @flags: PROCREPORT_REC_ROLLUP or PROCREPORT_REC_TOTALS.
+ */
+static void vma_report_fill_sum(struct vma_report *r, const struct vma_class_sum *sum,
+                                int cls, u32 flags)
+{
+    struct procreport_vma_record *rec = &r->rec;
+
+    memset(rec, 0, sizeof(*rec));
+    if (flags & PROCREPORT_REC_TOTALS) {
+        rec->pid = -1;
+    } else {
+        rec->pid = r->job.items[r->item].task->pid;
+        get_task_comm(rec->comm, r->job.items[r->item].task);
+    }
+    rec->flags = flags;
+    rec->vma_class = cls;
+    rec->nr_vmas = sum->nr_vmas;
+    vma_record_counts(rec, &sum->counts);
+}
+
+/**
+ * vma_report_fill - Produce the row at the cursor.
+ * @r: Reader state.
+ *
+ * Processes that exited or have no address space are skipped on the way.
+ *
+ * Returns the row, or NULL past the last one.
+ */
+static void *vma_report_fill(struct vma_report *r)
+{
+    while (r->item < r->job.nr_items) {
+        if (r->cls < 0) {
+            if (!r->mm)
+                r->mm = get_task_mm(r->job.items[r->item].task);
+            if (r->mm && vma_report_fill_vma(r))
+                return &r->rec;
+            r->cls = 0;         // VMAs done, on to this process's rollup
+        }
+        for (; r->cls < PROCREPORT_VMA_NR_CLASSES; r->cls++) {
+            if (r->proc[r->cls].nr_vmas) {
+                vma_report_fill_sum(r, &r->proc[r->cls], r->cls, PROCREPORT_REC_ROLLUP);
+                return &r->rec;
             }
         }
+
+        if (r->mm)
+            mmput(r->mm);
+        r->mm = NULL;
+        memset(r->proc, 0, sizeof(r->proc));
+        r->item++;
+        r->addr = 0;
+        r->cls = -1;
+    }
+
+    for (; r->all_cls < PROCREPORT_VMA_NR_CLASSES; r->all_cls++) {
+        if (r->all[r->all_cls].nr_vmas) {
+            vma_report_fill_sum(r, &r->all[r->all_cls], r->all_cls, PROCREPORT_REC_TOTALS);
+            return &r->rec;
+        }
+    }
+    return NULL;
+}
+
+// Position 0 is the CSV header or binary stream header; every later
+// position is the row vma_report_fill() finds from the cursor.
+
+static void *vma_report_start(struct seq_file *m, loff_t *pos)
+{
+    struct vma_report *r = m->private;
+
+    if (*pos == 0) {
+        r->item = 0;
+        r->addr = 0;
+        r->cls = -1;
+        r->all_cls = 0;
+        memset(r->proc, 0, sizeof(r->proc));
+        memset(r->all, 0, sizeof(r->all));
+        return SEQ_START_TOKEN;
+    }
+    return vma_report_fill(r);
+}
+
+static void *vma_report_next(struct seq_file *m, void *v, loff_t *pos)
+{
+    struct vma_report *r = m->private;
+
+    ++*pos;
+    if (v != SEQ_START_TOKEN) {
+        // Move the cursor past the row just shown.
+        if (r->rec.flags & PROCREPORT_REC_TOTALS) {
+            r->all_cls++;
+        } else if (r->rec.flags & PROCREPORT_REC_ROLLUP) {
+            r->cls++;
+        } else {
+            vma_sum_add(&r->proc[r->rec.vma_class], &r->rec);
+            vma_sum_add(&r->all[r->rec.vma_class], &r->rec);
+            r->addr = r->rec.end;
+        }
+    }
+    return vma_report_fill(r);
+}
+
+static void vma_report_stop(struct seq_file *m, void *v)
+{
+    struct vma_report *r = m->private;
+
+    // Never keep an address space alive while the reader is away.
+    if (r->mm)
+        mmput(r->mm);
+    r->mm = NULL;
+}
+
+static int vma_report_show(struct seq_file *m, void *v)
+{
+    struct vma_report *r = m->private;
+    const struct procreport_vma_record *rec = &r->rec;
+
+    if (r->binary) {
+        if (v == SEQ_START_TOKEN) {
+            struct procreport_stream_header hdr = {
+                .magic       = PROCREPORT_VMA_MAGIC,
+                .version     = PROCREPORT_VMA_VERSION,
+                .header_size = sizeof(hdr),
+                .record_size = sizeof(*rec),
+            };
+
+            seq_write(m, &hdr, sizeof(hdr));
+        } else {
+            seq_write(m, rec, sizeof(*rec));
+        }
+        return 0;
     }
 
-    // Adjust for the very first valid page encountered in the entire region.
-    // If we counted at least 1 total page, but contig+noncontig is still one less,
-    // mark the first page as non-contiguous by default.
-    if (contig && noncontig && *total > 0 && ((*contig + *noncontig) < *total))
-        (*noncontig)++;
+    if (v == SEQ_START_TOKEN) {
+        seq_puts(m, "proc_id,proc_name,vma_start,vma_end,vm_flags,inode,vma_class,"
+                    "nr_vmas,contig_pages,noncontig_pages,total_pages,huge_pages\n");
+    } else if (rec->flags) {
+        // Sums leave the VMA columns empty, like the TOTALS line of procReport.
+        if (rec->flags & PROCREPORT_REC_TOTALS)
+            seq_puts(m, "TOTALS,");
+        else
+            seq_printf(m, "%d,%s", rec->pid, rec->comm);
+        seq_printf(m, ",,,,,%s,%llu,%llu,%llu,%llu,%llu\n",
+                   vma_class_names[rec->vma_class], rec->nr_vmas, rec->contig,
+                   rec->noncontig, rec->total, rec->huge);
+    } else {
+        seq_printf(m, "%d,%s,%llx,%llx,%llx,%llu,%s,%llu,%llu,%llu,%llu,%llu\n",
+                   rec->pid, rec->comm, rec->start, rec->end, rec->vm_flags,
+                   rec->inode, vma_class_names[rec->vma_class], rec->nr_vmas,
+                   rec->contig, rec->noncontig, rec->total, rec->huge);
+    }
+    return 0;
 }
 
+static const struct seq_operations vma_report_seq_ops = {
+    .start = vma_report_start,
+    .next  = vma_report_next,
+    .stop  = vma_report_stop,
+    .show  = vma_report_show,
+};
+
+// Data of the two proc entries, telling vma_report_open() the format.
+static const bool vma_format_csv;
+static const bool vma_format_binary = true;
+
 /**
- * generate_report - Print the process report in CSV format.
+ * vma_report_open - Take the process list for a new per-VMA reader.
  *
- * Iterates over all processes with a PID > 650, computes the page counts, and logs
- * a CSV-formatted report to the kernel log.
+ * Only task references are kept; each address space is looked up again when
+ * the reader reaches it, so an open file pins at most one mm, and only
+ * during a read().
  */
-static void generate_report(void)
+static int vma_report_open(struct inode *inode, struct file *file)
 {
-    struct task_struct *proc;       // For iterating through processes
-    unsigned long proc_total;       // Holds total pages for a single process
-    unsigned long proc_contig;      // Holds contiguous count for a single process
-    unsigned long proc_noncontig;   // Holds non-contiguous count for a single process
-    unsigned long grand_total = 0;  // Accumulates total pages for all processes
-    unsigned long grand_contig = 0; // Accumulates contiguous pages for all processes
-    unsigned long grand_noncontig = 0; // Accumulates non-contiguous pages
+    struct vma_report *r;
+    unsigned int i;
+    int ret;
 
-    printk(KERN_INFO "PROCESS REPORT:\n"); 
-    // Print CSV header: pid, name, contig, noncontig, total
-    printk(KERN_INFO "proc_id,proc_name,contig_pages,noncontig_pages,total_pages\n");
+    r = __seq_open_private(file, &vma_report_seq_ops, sizeof(*r));
+    if (!r)
+        return -ENOMEM;
+    r->binary = *(const bool *)pde_data(inode);
 
-    // for_each_process() macro iterates through every task_struct in the system.
-    for_each_process(proc) {
-        // We only care about processes with PID > 650
-        if (proc->pid > 650) {
-            // Count allocated pages for this process
-            count_allocated_pages(proc, &proc_total, &proc_contig, &proc_noncontig);
+    mutex_lock(&scan_mutex);            // snapshot_tasks() reads the targets
+    ret = snapshot_tasks(&r->job, false);      // Outlives scan_mutex
+    mutex_unlock(&scan_mutex);
+    if (ret) {
+        seq_release_private(inode, file);
+        return ret;
+    }
+
+    for (i = 0; i < r->job.nr_items; i++) {
+        if (r->job.items[i].mm)
+            mmput(r->job.items[i].mm);
+        r->job.items[i].mm = NULL;
+    }
+    return 0;
+}
+
+static int vma_report_release(struct inode *inode, struct file *file)
+{
+    struct vma_report *r = ((struct seq_file *)file->private_data)->private;
+
+    release_snapshot(&r->job);
+    return seq_release_private(inode, file);
+}
+
+static struct proc_dir_entry *vma_csv_entry;   // /proc/procReport_vmas
+static struct proc_dir_entry *vma_bin_entry;   // /proc/procReport_vmas.bin
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+static const struct proc_ops vma_report_proc_ops = {
+    .proc_open    = vma_report_open,
+    .proc_read    = seq_read,
+    .proc_lseek   = seq_lseek,
+    .proc_release = vma_report_release,
+};
+#else
+static const struct file_operations vma_report_proc_ops = {
+    .owner   = THIS_MODULE,
+    .open    = vma_report_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = vma_report_release,
+};
+#endif
+
+//----------------------------------
+//       DEBUGFS STATISTICS
+//----------------------------------
+
+static struct dentry *stats_dir;    // /sys/kernel/debug/procReport
+
+/**
+ * scan_progress_show - Print the progress of the running scan and the lag.
+ *
+ * scan_units_done is read without scan_mutex and may be a scan behind.
+ * snapshot_lag_ms is how old the oldest data of the latest snapshot is: the
+ * time since that scan started, so a slow throttled scan shows up as lag.
+ */
+static void scan_progress_show(struct seq_file *m)
+{
+    u64 started = READ_ONCE(stats.scan_start_ns);
+    struct report_snapshot *snap = snapshot_get_latest();
+
+    seq_printf(m, "scan_in_progress_ms: %llu\n",
+               started ? div_u64(ktime_get_ns() - started, NSEC_PER_MSEC) : 0);
+    seq_printf(m, "scan_units_done: %u/%u\n", atomic_read(&stats.units_done),
+               READ_ONCE(stats.scan_units));
+    if (snap) {
+        u64 age_ns = ktime_get_real_ns() - snap->timestamp_ns;
+
+        seq_printf(m, "snapshot_lag_ms: %llu\n",
+                   div_u64(age_ns + snap->scan_us * NSEC_PER_USEC, NSEC_PER_MSEC));
+        snapshot_put(snap);
+    }
+}
+
+/**
+ * scan_stats_show - Print the instrumentation counters, one per line.
+ *
+ * Counters only grow, so tools compute rates from two reads; the last_*
+ * lines describe the most recent report on their own.
+ */
+static int scan_stats_show(struct seq_file *m, void *v)
+{
+    u64 walk_us = div_u64(READ_ONCE(stats.last_walk_ns), NSEC_PER_USEC);
+    unsigned int i;
+
+    seq_printf(m, "scans: %llu\n", READ_ONCE(stats.scans));
+    seq_printf(m, "scan_us_total: %llu\n", div_u64(READ_ONCE(stats.scan_ns), NSEC_PER_USEC));
+    seq_printf(m, "last_scan_us: %llu\n", div_u64(READ_ONCE(stats.last_scan_ns), NSEC_PER_USEC));
+    seq_printf(m, "last_snapshot_us: %llu\n",
+               div_u64(READ_ONCE(stats.last_snapshot_ns), NSEC_PER_USEC));
+    seq_printf(m, "last_plan_us: %llu\n", div_u64(READ_ONCE(stats.last_plan_ns), NSEC_PER_USEC));
+    seq_printf(m, "last_walk_us: %llu\n", walk_us);
+    seq_printf(m, "last_merge_us: %llu\n", div_u64(READ_ONCE(stats.last_merge_ns), NSEC_PER_USEC));
+    seq_printf(m, "last_ptes: %llu\n", READ_ONCE(stats.last_ptes));
+    seq_printf(m, "last_ptes_per_sec: %llu\n",
+               div64_u64(READ_ONCE(stats.last_ptes) * USEC_PER_SEC, max_t(u64, walk_us, 1)));
+    seq_printf(m, "processes_walked: %llu\n", READ_ONCE(stats.walked));
+    seq_printf(m, "process_walk_us_total: %llu\n", div_u64(READ_ONCE(stats.walk_ns), NSEC_PER_USEC));
+    seq_printf(m, "process_walk_us_max: %llu\n",
+               div_u64(READ_ONCE(stats.walk_max_ns), NSEC_PER_USEC));
+    seq_printf(m, "ptes: %lld\n", atomic64_read(&stats.ptes));
+    seq_printf(m, "holes_skipped: %lld\n", atomic64_read(&stats.holes));
+    seq_printf(m, "lock_holds: %lld\n", atomic64_read(&stats.lock_holds));
+    seq_printf(m, "lock_hold_us_total: %llu\n",
+               div_u64(atomic64_read(&stats.lock_hold_ns), NSEC_PER_USEC));
+    seq_printf(m, "cond_resched: %lld\n", atomic64_read(&stats.resched));
+    seq_printf(m, "allocs: %lld\n", atomic64_read(&stats.allocs));
+    seq_printf(m, "pool_reuses: %lld\n", atomic64_read(&stats.pool_reuses));
+    seq_printf(m, "throttle_sleeps: %lld\n", atomic64_read(&stats.throttle_sleeps));
+    seq_printf(m, "throttle_sleep_us_total: %llu\n",
+               div_u64(atomic64_read(&stats.throttle_ns), NSEC_PER_USEC));
+    seq_printf(m, "throttle_backoff: %u\n", READ_ONCE(stats.backoff));
+    scan_progress_show(m);
+
+    // Lower bound of each bucket in microseconds, 0 standing for "< 1 us".
+    seq_puts(m, "lock_hold_us_hist:");
+    for (i = 0; i < LOCK_HOLD_BUCKETS; i++)
+        seq_printf(m, " %lu:%lld", i ? 1UL << (i - 1) : 0UL,
+                   atomic64_read(&stats.lock_hist[i]));
+    seq_putc(m, '\n');
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(scan_stats);
+
+//----------------------------------
+//      VMA ITERATION BENCHMARK
+//----------------------------------
+#define VMA_BENCH_ROUNDS 16     // Best-of rounds to filter out noise
+
+/**
+ * bench_vma_iteration - Measure the cost of visiting every VMA of a process.
+ * @pid: Process to iterate, normally "bench/addr_space vmas 10000".
+ *
+ * Only the VMA iteration the walker relies on is timed, not the page tables
+ * behind it, so loading the module with the same target on a 5.x and a 6.x
+ * kernel compares the linked list with the maple tree directly.
+ */
+static void bench_vma_iteration(pid_t pid)
+{
+    struct task_struct *task;
+    struct mm_struct *mm;
+    s64 best_ns = S64_MAX;          // Fastest full iteration seen
+    unsigned long nr_vmas = 0;      // VMAs visited per round
+    unsigned long mapped = 0;       // Bytes covered, keeps the loop honest
+    int round;
+
+    rcu_read_lock();
+    task = pid_task(find_vpid(pid), PIDTYPE_PID);
+    if (task)
+        get_task_struct(task);
+    rcu_read_unlock();
+    if (!task) {
+        printk(KERN_WARNING "helloModule: vma_bench: no process %d\n", pid);
+        return;
+    }
+
+    mm = get_task_mm(task);
+    put_task_struct(task);
+    if (!mm) {
+        printk(KERN_WARNING "helloModule: vma_bench: process %d has no mm\n", pid);
+        return;
+    }
 
-            // Print the CSV line for this process
-            printk(KERN_INFO "%d,%s,%lu,%lu,%lu\n",
-                   proc->pid, proc->comm, proc_contig, proc_noncontig, proc_total);
+    mmap_read_lock(mm);
+    for (round = 0; round < VMA_BENCH_ROUNDS; round++) {
+        struct vm_area_struct *area;
+        ktime_t start = ktime_get();
+        VMA_CURSOR(vmi, mm, 0);
 
-            // Accumulate grand totals
-            grand_total     += proc_total;
-            grand_contig    += proc_contig;
-            grand_noncontig += proc_noncontig;
+        nr_vmas = 0;
+        mapped = 0;
+        for_each_vma_cursor(vmi, area, TASK_SIZE) {
+            nr_vmas++;
+            mapped += area->vm_end - area->vm_start;
         }
+        best_ns = min(best_ns, ktime_to_ns(ktime_sub(ktime_get(), start)));
     }
+    mmap_read_unlock(mm);
+    mmput(mm);
 
-    // Print total line in CSV format
-    printk(KERN_INFO "TOTALS,,%lu,%lu,%lu\n",
-           grand_contig, grand_noncontig, grand_total);
+    printk(KERN_INFO "helloModule: vma_bench: pid %d, %lu VMAs (%lu KiB), %s, "
+           "best of %d: %lld ns, %lld ns/VMA\n",
+           pid, nr_vmas, mapped >> 10, VMA_ITER_KIND, VMA_BENCH_ROUNDS, best_ns,
+           nr_vmas ? best_ns / (s64)nr_vmas : 0);
 }
 
 /**
  * helloModule_init - Module initialization routine.
  *
- * Logs the start of the module, generates the process report,
- * and confirms successful loading.
+ * Logs the start of the module, sets up the worker pool and the
+ * /proc/procReport entry, and confirms successful loading.
  */
 static int __init helloModule_init(void)
 {
     printk(KERN_INFO "helloModule: Initializing module...\n");
-    generate_report(); // Generate the CSV-style process report
+
+    mm_cache_slab = KMEM_CACHE(mm_cache_entry, 0);
+    if (!mm_cache_slab)
+        return -ENOMEM;
+
+    // Unbound so the workers spread over all CPUs; a failure just means
+    // the report is produced serially.
+    scan_wq = alloc_workqueue("procReport", WQ_UNBOUND | WQ_SYSFS, 0);
+    if (!scan_wq)
+        printk(KERN_WARNING "helloModule: No scan workqueue, scanning serially\n");
+
+    // The CSV report is generated whenever /proc/procReport is opened, or
+    // taken from the background sampler when sample_interval_ms is set.
+    // Root only, like the per-VMA files: an open walks every process under
+    // its mmap_lock, and the reports show other users' memory layout and
+    // physical placement, which pagemap also keeps from them. Readers of
+    // procReport_delta would also move the shared baseline forward.
+    report_entry = proc_create_data("procReport", 0400, NULL, &report_proc_ops,
+                                    (void *)&report_seq_ops);
+    runs_entry = proc_create_data("procReport_runs", 0400, NULL, &report_proc_ops,
+                                  (void *)&runs_seq_ops);
+    delta_entry = proc_create("procReport_delta", 0400, NULL, &delta_proc_ops);
+    estimate_entry = proc_create("procReport_estimate", 0400, NULL, &estimate_proc_ops);
+    live_entry = proc_create_single("procReport_live", 0400, NULL, live_show);
+    physmap_entry = proc_create_data("procReport_physmap", 0400, NULL, &physmap_proc_ops,
+                                     (void *)&physmap_seq_ops);
+    pins_entry = proc_create_data("procReport_physmap_pins", 0400, NULL, &physmap_proc_ops,
+                                  (void *)&pins_seq_ops);
+    if (!report_entry || !runs_entry || !delta_entry || !estimate_entry || !live_entry ||
+        !physmap_entry || !pins_entry) {
+        printk(KERN_ERR "helloModule: Could not create /proc/procReport\n");
+        proc_remove(pins_entry);
+        proc_remove(physmap_entry);
+        proc_remove(live_entry);
+        proc_remove(estimate_entry);
+        proc_remove(delta_entry);
+        proc_remove(runs_entry);
+        proc_remove(report_entry);
+        if (scan_wq)
+            destroy_workqueue(scan_wq);
+        kmem_cache_destroy(mm_cache_slab);
+        return -ENOMEM;
+    }
+
+    // The per-VMA breakdown exposes address-space layouts, so root only.
+    vma_csv_entry = proc_create_data("procReport_vmas", 0400, NULL,
+                                     &vma_report_proc_ops, (void *)&vma_format_csv);
+    vma_bin_entry = proc_create_data("procReport_vmas.bin", 0400, NULL,
+                                     &vma_report_proc_ops, (void *)&vma_format_binary);
+    if (!vma_csv_entry || !vma_bin_entry) {
+        printk(KERN_ERR "helloModule: Could not create /proc/procReport_vmas\n");
+        proc_remove(vma_bin_entry);
+        proc_remove(vma_csv_entry);
+        proc_remove(pins_entry);
+        proc_remove(physmap_entry);
+        proc_remove(live_entry);
+        proc_remove(estimate_entry);
+        proc_remove(delta_entry);
+        proc_remove(runs_entry);
+        proc_remove(report_entry);
+        if (scan_wq)
+            destroy_workqueue(scan_wq);
+        kmem_cache_destroy(mm_cache_slab);
+        return -ENOMEM;
+    }
+
+    // The optional binary ring is fed by every scan, whoever triggered it.
+    if (ring_records) {
+        if (ring_init(ring_records) || misc_register(&ring_dev)) {
+            printk(KERN_ERR "helloModule: Could not set up /dev/procReport\n");
+            ring_exit();
+            proc_remove(vma_bin_entry);
+            proc_remove(vma_csv_entry);
+            proc_remove(pins_entry);
+            proc_remove(physmap_entry);
+            proc_remove(live_entry);
+            proc_remove(estimate_entry);
+            proc_remove(delta_entry);
+            proc_remove(runs_entry);
+            proc_remove(report_entry);
+            if (scan_wq)
+                destroy_workqueue(scan_wq);
+            kmem_cache_destroy(mm_cache_slab);
+            return -ENOMEM;
+        }
+    }
+
+    // On-demand requests are walked on the pool, so there is no device
+    // without one.
+    if (scan_wq) {
+        if (misc_register(&req_dev))
+            printk(KERN_WARNING "helloModule: Could not create /dev/procReport_ctl\n");
+        else
+            req_dev_registered = true;
+    }
+
+    // Statistics are a debugging aid; running without debugfs is fine.
+    stats_dir = debugfs_create_dir("procReport", NULL);
+    debugfs_create_file("stats", 0400, stats_dir, NULL, &scan_stats_fops);
+
+    mutex_lock(&sampler_lock);
+    sampler_ready = true;
+    if (READ_ONCE(sample_interval_ms))
+        queue_delayed_work(system_unbound_wq, &sample_work, 0);
+    mutex_unlock(&sampler_lock);
+
+    if (vma_bench_pid > 0)
+        bench_vma_iteration(vma_bench_pid);
     printk(KERN_INFO "helloModule: Module loaded successfully.\n");
     return 0;          // Return 0 to indicate successful init
 }
@@ -216,10 +5367,52 @@ static int __init helloModule_init(void)
 /**
  * helloModule_exit - Module cleanup routine.
  *
- * Logs the module unloading.
+ * Removes /proc/procReport and logs the module unloading.
  */
 static void __exit helloModule_exit(void)
 {
+    // Stop the sampler first so nothing publishes while we tear down. Once
+    // sampler_ready is cleared under the lock, no parameter write re-arms it.
+    mutex_lock(&sampler_lock);
+    sampler_ready = false;
+    WRITE_ONCE(sample_interval_ms, 0);
+    mutex_unlock(&sampler_lock);
+    cancel_delayed_work_sync(&sample_work);
+
+    // Waits for open readers to go away before the report code is freed.
+    debugfs_remove_recursive(stats_dir);
+    proc_remove(report_entry);
+    proc_remove(runs_entry);
+    proc_remove(delta_entry);
+    proc_remove(estimate_entry);
+    proc_remove(pins_entry);
+    proc_remove(physmap_entry);
+    proc_remove(live_entry);
+    proc_remove(vma_bin_entry);
+    proc_remove(vma_csv_entry);
+    if (ring.hdr)
+        misc_deregister(&ring_dev);
+    if (req_dev_registered)
+        misc_deregister(&req_dev);     // Queued walks drain with scan_wq below
+
+    snapshot_put(rcu_dereference_protected(latest_snapshot, 1));
+    RCU_INIT_POINTER(latest_snapshot, NULL);
+    snapshot_put(delta_base);
+    rcu_barrier();              // Let pending snapshot frees finish
+    kvfree(spare_snapshot);
+    scan_buf_free(&items_buf);
+    scan_buf_free(&units_buf);
+    scan_buf_free(&order_buf);
+    scan_buf_free(&queues_buf);
+    scan_buf_free(&workers_buf);
+    scan_buf_free(&phys_buf);
+    ring_exit();
+    mm_cache_flush();
+    tracked_mm_sync();          // Trackers are freed after an SRCU grace period
+    kmem_cache_destroy(mm_cache_slab);
+    targets_release();
+    if (scan_wq)
+        destroy_workqueue(scan_wq);
     printk(KERN_INFO "helloModule: Module unloaded.\n");
 }
 
@@ -0,0 +1,236 @@
+/**
+ * procReport_abi.h - Binary interface shared by procReport and its collectors
+ *
+ * When the module is loaded with ring_records=N it creates /dev/procReport.
+ * The device can be mmap()ed read-only to get a ring buffer of fixed-size
+ * records, one per reported process plus one TOTALS record that ends each
+ * scan. Collectors read the records in place, with no CSV formatting or
+ * parsing on either side.
+ *
+ * Layout: a struct procreport_ring_header at offset 0, followed by
+ * nr_records records of record_size bytes starting at header_size. Record
+ * number i (counting from the first record ever written) lives in slot
+ * i & (nr_records - 1).
+ *
+ * Reading protocol (single producer, any number of readers):
+ *   1. h1 = head, read with acquire semantics.
+ *   2. Copy the records wanted from [max(tail, h1 - nr_records), h1).
+ *   3. h2 = head, read again after the copy (read barrier in between).
+ *   4. A copied record i is intact only if i + nr_records > h2; older ones
+ *      may have been overwritten while being copied and must be dropped.
+ *
+ * Versioning: readers must check magic and version. Fields are only ever
+ * appended to the end of a structure; header_size and record_size give the
+ * real sizes, so older readers can skip fields they do not know.
+ *
+ * Per-VMA breakdown: /proc/procReport_vmas.bin streams the same rows as the
+ * CSV file /proc/procReport_vmas. It starts with one
+ * struct procreport_stream_header, followed by struct procreport_vma_record
+ * entries of record_size bytes each until end of file: every VMA of every
+ * selected process, then one PROCREPORT_REC_ROLLUP record per VMA class the
+ * process uses, and finally one PROCREPORT_REC_TOTALS record per VMA class
+ * summing up all processes.
+ *
+ * On-demand scans: /dev/procReport_ctl takes PROCREPORT_IOC_SCAN requests
+ * for a set of PIDs and returns at once with a request ID in
+ * procreport_scan_request.id; the scan runs on the module's worker pool.
+ * The file polls readable once any of its requests has finished, and read()
+ * then returns whole results: a struct procreport_scan_done followed by
+ * nr_records struct procreport_record entries of record_size bytes, the
+ * last one PROCREPORT_REC_TOTALS. A buffer too small for the next result
+ * fails with EINVAL. Identical requests queued by anyone before the walk
+ * started share that walk; each still gets its own ID and result.
+ *
+ * This header is included by the module and by userspace alike.
+ */
+#ifndef PROCREPORT_ABI_H
+#define PROCREPORT_ABI_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define PROCREPORT_RING_MAGIC       0x50525054U  // "PRPT"
+#define PROCREPORT_RING_VERSION     1
+#define PROCREPORT_VMA_MAGIC        0x50525056U  // "PRPV"
+#define PROCREPORT_VMA_VERSION      1
+#define PROCREPORT_COMM_LEN         16           // Same as TASK_COMM_LEN
+#define PROCREPORT_RUN_BUCKETS      20           // log2 run lengths, 4 KiB to 2 GiB+
+#define PROCREPORT_MAX_NODES        16           // NUMA nodes with their own count
+#define PROCREPORT_REQ_MAX_PIDS     64           // PIDs in one on-demand scan
+
+// procreport_record.flags and procreport_vma_record.flags
+#define PROCREPORT_REC_TOTALS       0x1          // End-of-scan totals, pid is -1
+#define PROCREPORT_REC_ROLLUP       0x2          // Per-process sum of one VMA class
+
+// procreport_vma_record.vma_class
+#define PROCREPORT_VMA_ANON         0            // Other private anonymous memory
+#define PROCREPORT_VMA_HEAP         1            // brk() heap
+#define PROCREPORT_VMA_STACK        2            // Main or grows-down stack
+#define PROCREPORT_VMA_FILE_TEXT    3            // Executable file mapping
+#define PROCREPORT_VMA_FILE_DATA    4            // Other file mapping
+#define PROCREPORT_VMA_SHMEM        5            // shmem/tmpfs, SysV shm, shared anonymous
+#define PROCREPORT_VMA_DEVICE       6            // VM_IO/VM_PFNMAP/VM_MIXEDMAP driver mapping
+#define PROCREPORT_VMA_NR_CLASSES   7
+
+// procreport_scan_request.detail
+#define PROCREPORT_DETAIL_TOTALS    0            // Only the TOTALS record
+#define PROCREPORT_DETAIL_PROCESSES 1            // One record per process, then TOTALS
+
+// procreport_scan_request.flags
+#define PROCREPORT_SCAN_PSS         0x1          // Compute pss_kb, as with pss_accounting
+
+/**
+ * struct procreport_ring_header - Start of the mapped ring buffer.
+ * @magic:       PROCREPORT_RING_MAGIC.
+ * @version:     PROCREPORT_RING_VERSION.
+ * @header_size: Offset of the first record slot.
+ * @record_size: Size of one record slot.
+ * @nr_records:  Number of record slots, a power of two.
+ * @reserved:    Zero.
+ * @head:        Number of records ever written; slot of the next record.
+ * @scan_seq:    Sequence number of the last scan fully written to the ring.
+ */
+struct procreport_ring_header {
+    __u32 magic;
+    __u32 version;
+    __u32 header_size;
+    __u32 record_size;
+    __u32 nr_records;
+    __u32 reserved;
+    __u64 head;
+    __u64 scan_seq;
+};
+
+/**
+ * struct procreport_record - One process (or totals) row of a scan.
+ * @pid:          Process ID, or -1 for a PROCREPORT_REC_TOTALS record.
+ * @flags:        PROCREPORT_REC_* flags.
+ * @comm:         Process name, NUL terminated.
+ * @contig:       contig_pages column.
+ * @noncontig:    noncontig_pages column.
+ * @total:        total_pages column.
+ * @huge:         huge_pages column.
+ * @timestamp_ns: CLOCK_REALTIME time the scan finished, in nanoseconds.
+ * @scan_seq:     Scan this record belongs to.
+ * @pmd_aligned:  pmd_aligned column: 2 MiB blocks a PMD could map in place.
+ * @runs:         Physical run-length histogram; runs[i] counts runs of
+ *                2^i to 2^(i+1) - 1 pages, the last bucket all longer ones.
+ * @swap:         swap_pages column.
+ * @anon:         anon_pages column.
+ * @file:         file_pages column.
+ * @pss_kb:       pss_kb column; 0 unless the module has pss_accounting set.
+ * @nodes:        Resident pages per NUMA node; the last slot also holds
+ *                every node past it.
+ */
+struct procreport_record {
+    __s32 pid;
+    __u32 flags;
+    char  comm[PROCREPORT_COMM_LEN];
+    __u64 contig;
+    __u64 noncontig;
+    __u64 total;
+    __u64 huge;
+    __u64 timestamp_ns;
+    __u64 scan_seq;
+    __u64 pmd_aligned;
+    __u64 runs[PROCREPORT_RUN_BUCKETS];
+    __u64 swap;
+    __u64 anon;
+    __u64 file;
+    __u64 pss_kb;
+    __u64 nodes[PROCREPORT_MAX_NODES];
+};
+
+/**
+ * struct procreport_stream_header - Start of a streamed binary report.
+ * @magic:       PROCREPORT_VMA_MAGIC.
+ * @version:     PROCREPORT_VMA_VERSION.
+ * @header_size: Offset of the first record.
+ * @record_size: Size of one record.
+ */
+struct procreport_stream_header {
+    __u32 magic;
+    __u32 version;
+    __u32 header_size;
+    __u32 record_size;
+};
+
+/**
+ * struct procreport_vma_record - One VMA, or a sum over one VMA class.
+ * @pid:       Process ID, or -1 for a PROCREPORT_REC_TOTALS record.
+ * @flags:     PROCREPORT_REC_* flags; 0 for a single VMA.
+ * @comm:      Process name, NUL terminated; empty for totals.
+ * @vma_class: PROCREPORT_VMA_* class of the VMA(s).
+ * @reserved:  Zero.
+ * @start:     First address of the VMA; 0 for sums.
+ * @end:       End of the VMA (exclusive); 0 for sums.
+ * @vm_flags:  VM_* flags of the VMA; 0 for sums.
+ * @inode:     Inode number of the backing file, 0 if anonymous or a sum.
+ * @nr_vmas:   VMAs summed up; 1 for a single VMA.
+ * @contig:    contig_pages column.
+ * @noncontig: noncontig_pages column.
+ * @total:     total_pages column.
+ * @huge:      huge_pages column.
+ *
+ * Contiguity is judged within each VMA: the first page of every VMA counts
+ * as non-contiguous, so sums can differ slightly from /proc/procReport.
+ */
+struct procreport_vma_record {
+    __s32 pid;
+    __u32 flags;
+    char  comm[PROCREPORT_COMM_LEN];
+    __u32 vma_class;
+    __u32 reserved;
+    __u64 start;
+    __u64 end;
+    __u64 vm_flags;
+    __u64 inode;
+    __u64 nr_vmas;
+    __u64 contig;
+    __u64 noncontig;
+    __u64 total;
+    __u64 huge;
+};
+
+/**
+ * struct procreport_scan_request - Argument of PROCREPORT_IOC_SCAN.
+ * @nr_pids:  Valid entries in @pids, 1 to PROCREPORT_REQ_MAX_PIDS.
+ * @detail:   PROCREPORT_DETAIL_* level of the result.
+ * @flags:    PROCREPORT_SCAN_* flags.
+ * @reserved: Zero.
+ * @id:       Set by the module: ID of the request, never 0.
+ * @pids:     Processes to scan, as seen in the caller's PID namespace.
+ *            Duplicates are ignored; processes that are gone by the time
+ *            the walk runs have no record.
+ */
+struct procreport_scan_request {
+    __u32 nr_pids;
+    __u32 detail;
+    __u32 flags;
+    __u32 reserved;
+    __u64 id;
+    __s32 pids[PROCREPORT_REQ_MAX_PIDS];
+};
+
+/**
+ * struct procreport_scan_done - Start of one result read from the device.
+ * @id:          ID the request was given.
+ * @status:      0, or a negative errno; then @nr_records is 0.
+ * @nr_records:  Records following this structure.
+ * @header_size: Size of this structure, where the first record starts.
+ * @record_size: Size of one record.
+ *
+ * The records have scan_seq 0: on-demand scans are not report scans.
+ */
+struct procreport_scan_done {
+    __u64 id;
+    __s32 status;
+    __u32 nr_records;
+    __u32 header_size;
+    __u32 record_size;
+};
+
+#define PROCREPORT_IOC_MAGIC        0xb7
+#define PROCREPORT_IOC_SCAN         _IOWR(PROCREPORT_IOC_MAGIC, 1, struct procreport_scan_request)
+
+#endif // PROCREPORT_ABI_H
@@ -0,0 +1,126 @@
+/**
+ * procReport_trace.h - Tracepoints of the procReport scanner
+ *
+ * The events mark the boundaries of a scan so perf or bpftrace can attach
+ * to them without patching the module:
+ *   procreport:procreport_vma        - a VMA range is about to be walked
+ *   procreport:procreport_lock_hold  - a walk dropped mmap_lock again
+ *   procreport:procreport_process    - a process result is complete
+ *   procreport:procreport_scan       - a report is complete
+ *
+ * e.g.: perf record -e 'procreport:*' -a -- cat /proc/procReport
+ *
+ * Only included by procReport.c, which defines CREATE_TRACE_POINTS.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM procreport
+
+#if !defined(PROCREPORT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define PROCREPORT_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(procreport_vma,
+
+    TP_PROTO(struct mm_struct *mm, unsigned long start, unsigned long end,
+             unsigned long vm_flags),
+
+    TP_ARGS(mm, start, end, vm_flags),
+
+    TP_STRUCT__entry(
+        __field(const void *,   mm)
+        __field(unsigned long,  start)
+        __field(unsigned long,  end)
+        __field(unsigned long,  vm_flags)
+    ),
+
+    TP_fast_assign(
+        __entry->mm       = mm;
+        __entry->start    = start;
+        __entry->end      = end;
+        __entry->vm_flags = vm_flags;
+    ),
+
+    TP_printk("mm=%p range=%lx-%lx vm_flags=%#lx",
+              __entry->mm, __entry->start, __entry->end, __entry->vm_flags)
+);
+
+TRACE_EVENT(procreport_lock_hold,
+
+    TP_PROTO(struct mm_struct *mm, u64 hold_ns, bool yielded),
+
+    TP_ARGS(mm, hold_ns, yielded),
+
+    TP_STRUCT__entry(
+        __field(const void *,   mm)
+        __field(u64,            hold_ns)
+        __field(bool,           yielded)
+    ),
+
+    TP_fast_assign(
+        __entry->mm      = mm;
+        __entry->hold_ns = hold_ns;
+        __entry->yielded = yielded;
+    ),
+
+    TP_printk("mm=%p hold_ns=%llu yielded=%d",
+              __entry->mm, __entry->hold_ns, __entry->yielded)
+);
+
+TRACE_EVENT(procreport_process,
+
+    TP_PROTO(struct task_struct *task, unsigned long total, u64 walk_ns),
+
+    TP_ARGS(task, total, walk_ns),
+
+    TP_STRUCT__entry(
+        __field(pid_t,          pid)
+        __array(char,           comm, TASK_COMM_LEN)
+        __field(unsigned long,  total)
+        __field(u64,            walk_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->pid = task->pid;
+        memcpy(__entry->comm, task->comm, TASK_COMM_LEN);
+        __entry->total   = total;
+        __entry->walk_ns = walk_ns;
+    ),
+
+    TP_printk("pid=%d comm=%s total_pages=%lu walk_ns=%llu",
+              __entry->pid, __entry->comm, __entry->total, __entry->walk_ns)
+);
+
+TRACE_EVENT(procreport_scan,
+
+    TP_PROTO(u64 seq, unsigned int nr_rows, int nr_workers, s64 scan_us),
+
+    TP_ARGS(seq, nr_rows, nr_workers, scan_us),
+
+    TP_STRUCT__entry(
+        __field(u64,            seq)
+        __field(unsigned int,   nr_rows)
+        __field(int,            nr_workers)
+        __field(s64,            scan_us)
+    ),
+
+    TP_fast_assign(
+        __entry->seq        = seq;
+        __entry->nr_rows    = nr_rows;
+        __entry->nr_workers = nr_workers;
+        __entry->scan_us    = scan_us;
+    ),
+
+    TP_printk("seq=%llu rows=%u workers=%d scan_us=%lld",
+              __entry->seq, __entry->nr_rows, __entry->nr_workers, __entry->scan_us)
+);
+
+#endif // PROCREPORT_TRACE_H
+
+// Out of tree, so define_trace.h has to be told where this header lives;
+// the Makefile adds the module directory to the include path.
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE procReport_trace
+#include <trace/define_trace.h>